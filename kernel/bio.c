@@ -1,13 +1,16 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
+// * To get buffers for several consecutive blocks, call breadv.
 // * After changing buffer data, call bwrite to write it to disk.
+// * To write several buffers at once, call bwritev.
+// * To start reading a block that will be needed soon, call bprefetch.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
@@ -23,69 +26,176 @@
 #include "fs.h"
 #include "buf.h"
 
-struct {
-  struct spinlock lock;
-  struct buf buf[NBUF];
+#define NBUCKET 61   // prime, so blocknos spread evenly
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+// Buffers are kept in a hash table keyed on (dev, blockno),
+// each bucket with its own lock, so lookups of different blocks
+// proceed in parallel.  There is no global LRU list: brelse()
+// stamps a buffer with the time it became unused, and a miss
+// evicts the unused buffer with the oldest stamp.
+struct {
+  struct spinlock evictlock; // serializes misses
+  struct {
+    struct spinlock lock;
+    struct buf *head;        // singly linked through next
+  } bucket[NBUCKET];
 } bcache;
 
+// readahead counters, printed by ^T.
+static struct {
+  uint issued;   // blocks read by bprefetch()
+  uint hit;      // ... and later used
+  uint wasted;   // ... and evicted unused
+} rastats;
+
+static uint
+bhash(uint dev, uint blockno)
+{
+  return (dev * 31 + blockno) % NBUCKET;
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  char *page = 0;
+  int left = 0;
+
+  initlock(&bcache.evictlock, "bcache.evict");
+  for(int i = 0; i < NBUCKET; i++)
+    initlock(&bcache.bucket[i].lock, "bcache.bucket");
 
-  initlock(&bcache.lock, "bcache");
+  // Carve NBUF buffers out of kalloc() pages and spread
+  // them over the buckets; none of them is valid yet.
+  for(int i = 0; i < NBUF; i++){
+    if(left == 0){
+      if((page = kalloc()) == 0)
+        panic("binit");
+      left = PGSIZE / sizeof(struct buf);
+    }
+    b = (struct buf*)page;
+    page += sizeof(struct buf);
+    left--;
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->iodone = 0;
+    b->ra = 0;
+    b->valid = 0;
+    b->refcnt = 0;
+    b->lastuse = 0;
+    b->dev = 0;
+    b->blockno = i;
+    b->next = bcache.bucket[bhash(0, i)].head;
+    bcache.bucket[bhash(0, i)].head = b;
   }
 }
 
+// Search bucket h for (dev, blockno).  Caller holds the bucket lock.
+static struct buf*
+blookup(int h, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bcache.bucket[h].head; b; b = b->next)
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  return 0;
+}
+
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
 static struct buf*
 bget(uint dev, uint blockno)
 {
-  struct buf *b;
+  struct buf *b, *victim, **pp, **victimpp;
+  int h = bhash(dev, blockno);
+  int vh;
 
-  acquire(&bcache.lock);
+  acquire(&bcache.bucket[h].lock);
+  if((b = blookup(h, dev, blockno)) != 0){
+    b->refcnt++;
+    release(&bcache.bucket[h].lock);
+    acquiresleep(&b->lock);
+    return b;
+  }
+  release(&bcache.bucket[h].lock);
 
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  // Not cached.  Only one miss at a time looks for a victim;
+  // the evictor may hold several bucket locks, but everyone
+  // else holds at most one, so there is no deadlock.
+  acquire(&bcache.evictlock);
+
+  // Someone may have cached it while we waited.
+  acquire(&bcache.bucket[h].lock);
+  if((b = blookup(h, dev, blockno)) != 0){
+    b->refcnt++;
+    release(&bcache.bucket[h].lock);
+    release(&bcache.evictlock);
+    acquiresleep(&b->lock);
+    return b;
   }
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  // Find the least recently used unused buffer.  Keep the lock
+  // of the bucket holding the best candidate so far, so that it
+  // cannot be taken from under us.
+  victim = 0;
+  victimpp = 0;
+  vh = -1;
+  for(int i = 0; i < NBUCKET; i++){
+    if(i != h)
+      acquire(&bcache.bucket[i].lock);
+    int found = 0;
+    for(pp = &bcache.bucket[i].head; *pp; pp = &(*pp)->next){
+      b = *pp;
+      if(b->refcnt == 0 && (victim == 0 || b->lastuse < victim->lastuse)){
+        victim = b;
+        victimpp = pp;
+        found = 1;
+      }
     }
+    if(found){
+      if(vh != -1 && vh != h && vh != i)
+        release(&bcache.bucket[vh].lock);
+      vh = i;
+    } else if(i != h){
+      release(&bcache.bucket[i].lock);
+    }
+  }
+  if(victim == 0)
+    panic("bget: no buffers");
+
+  // Move the victim to bucket h.
+  if(vh != h){
+    *victimpp = victim->next;
+    release(&bcache.bucket[vh].lock);
+    victim->next = bcache.bucket[h].head;
+    bcache.bucket[h].head = victim;
+  }
+  if(victim->ra){
+    // read ahead but never used.
+    victim->ra = 0;
+    __sync_fetch_and_add(&rastats.wasted, 1);
+  }
+  victim->dev = dev;
+  victim->blockno = blockno;
+  victim->valid = 0;
+  victim->refcnt = 1;
+  release(&bcache.bucket[h].lock);
+  release(&bcache.evictlock);
+  acquiresleep(&victim->lock);
+  return victim;
+}
+
+// Called when a process gets b from the cache.  Counts
+// whether readahead brought it in.
+static void
+bused(struct buf *b)
+{
+  if(b->ra){
+    b->ra = 0;
+    __sync_fetch_and_add(&rastats.hit, 1);
   }
-  panic("bget: no buffers");
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -99,9 +209,36 @@ bread(uint dev, uint blockno)
     virtio_disk_rw(b, 0);
     b->valid = 1;
   }
+  bused(b);
   return b;
 }
 
+// Return locked bufs for the n blocks starting at blockno,
+// reading the ones not in the cache with as few disk requests
+// as possible.  The bufs are locked in ascending block order.
+void
+breadv(uint dev, uint blockno, int n, struct buf **bufs)
+{
+  struct buf *rd[MAXRUN];
+  int nrd = 0;
+
+  if(n > MAXRUN)
+    panic("breadv");
+  for(int i = 0; i < n; i++){
+    bufs[i] = bget(dev, blockno + i);
+    bused(bufs[i]);
+    if(!bufs[i]->valid)
+      rd[nrd++] = bufs[i];
+  }
+  if(nrd == 0)
+    return;
+  virtio_disk_submit(rd, nrd, 0);
+  for(int i = 0; i < nrd; i++){
+    virtio_disk_wait(rd[i]);
+    rd[i]->valid = 1;
+  }
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,43 +248,116 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
-// Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// Write n locked bufs to disk as one batch, so that the disk
+// can work on them concurrently, and wait for all of them.
 void
-brelse(struct buf *b)
+bwritev(struct buf **bufs, int n)
 {
-  if(!holdingsleep(&b->lock))
-    panic("brelse");
+  for(int i = 0; i < n; i++)
+    if(!holdingsleep(&bufs[i]->lock))
+      panic("bwritev");
+  virtio_disk_submit(bufs, n, 1);
+  for(int i = 0; i < n; i++)
+    virtio_disk_wait(bufs[i]);
+}
+
+// Drop a reference to b and unlock it.
+// If no one else holds it, note when it became unused.
+static void
+bput(struct buf *b)
+{
+  int h;
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  h = bhash(b->dev, b->blockno);
+  acquire(&bcache.bucket[h].lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->lastuse = ticks;
+  }
+  release(&bcache.bucket[h].lock);
+}
+
+// Completion of a bprefetch() read, in interrupt context.
+// The reading process has long moved on, so release the
+// buffer on its behalf.
+static void
+prefetchdone(struct buf *b)
+{
+  b->iodone = 0;
+  b->valid = 1;
+  bput(b);
+}
+
+// Start reading the n blocks starting at blockno into the
+// cache, skipping ones that are there already, without waiting
+// for them.  A later bread() of such a block waits on the buffer
+// lock until its read completes.
+void
+bprefetch(uint dev, uint blockno, int n)
+{
+  struct buf *b, *rd[MAXRUN];
+  int nrd = 0;
+
+  if(n > MAXRUN)
+    panic("bprefetch");
+  for(int i = 0; i < n; i++){
+    int h = bhash(dev, blockno + i);
+    acquire(&bcache.bucket[h].lock);
+    b = blookup(h, dev, blockno + i);
+    release(&bcache.bucket[h].lock);
+    if(b)
+      continue;  // cached, or already being read
+
+    b = bget(dev, blockno + i);
+    if(b->valid){
+      bput(b);
+      continue;
+    }
+    b->ra = 1;
+    b->iodone = prefetchdone;
+    rd[nrd++] = b;
   }
-  
-  release(&bcache.lock);
+  if(nrd == 0)
+    return;
+  __sync_fetch_and_add(&rastats.issued, nrd);
+  virtio_disk_submit(rd, nrd, 0);
+}
+
+// Print readahead counters.
+void
+bstats(void)
+{
+  printf("readahead: issued %d hit %d wasted %d\n",
+         rastats.issued, rastats.hit, rastats.wasted);
+}
+
+// Release a locked buffer.
+void
+brelse(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("brelse");
+
+  bput(b);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  int h = bhash(b->dev, b->blockno);
+
+  acquire(&bcache.bucket[h].lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bcache.bucket[h].lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  int h = bhash(b->dev, b->blockno);
+
+  acquire(&bcache.bucket[h].lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bcache.bucket[h].lock);
 }
-
-
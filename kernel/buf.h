@@ -1,12 +1,14 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  int ra;      // read by bprefetch() and not used yet
+  void (*iodone)(struct buf*); // called from the disk interrupt, if set
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
-  struct buf *next;
+  uint lastuse; // ticks when refcnt last dropped to 0
+  struct buf *next; // hash bucket list
   uchar data[BSIZE];
 };
 
@@ -7,6 +7,7 @@
 //   control-u -- kill line
 //   control-d -- end of file
 //   control-p -- print process list
+//   control-t -- print kernel counters
 //
 
 #include <stdarg.h>
@@ -80,7 +81,7 @@ int
 consoleread(int user_dst, uint64 dst, int n)
 {
   uint target;
-  int c;
+  int c, r;
   char cbuf;
 
   target = n;
@@ -107,10 +108,21 @@ consoleread(int user_dst, uint64 dst, int n)
       break;
     }
 
-    // copy the input byte to the user-space buffer.
+    // copy the input byte to the user-space buffer.  if the
+    // page isn't faulted in yet, put the byte back and fault it
+    // in without cons.lock, since vmfault() may sleep.
     cbuf = c;
-    if(either_copyout(user_dst, dst, &cbuf, 1) == -1)
-      break;
+    if(either_copyout(user_dst, dst, &cbuf, 1) == -1){
+      cons.r--;
+      if(!user_dst)
+        break;
+      release(&cons.lock);
+      r = vmfault(myproc(), dst, 1);
+      acquire(&cons.lock);
+      if(r < 0)
+        break;
+      continue;
+    }
 
     dst++;
     --n;
@@ -126,6 +138,26 @@ consoleread(int user_dst, uint64 dst, int n)
   return target - n;
 }
 
+//
+// print the counters kept by kernel subsystems.
+// for debugging; no locks, so the numbers may be
+// slightly inconsistent with each other.
+//
+static void
+statsdump(void)
+{
+  printf("\n");
+  slabstats();
+  bstats();
+  dcachestats();
+  pcachestats();
+#ifdef LAB_NET
+  mbufstats();
+  e1000stats();
+  sockstats();
+#endif
+}
+
 //
 // the console input interrupt handler.
 // uartintr() calls this for input character.
@@ -141,6 +173,9 @@ consoleintr(int c)
   case C('P'):  // Print process list.
     procdump();
     break;
+  case C('T'):  // Print kernel counters.
+    statsdump();
+    break;
   case C('U'):  // Kill line.
     while(cons.e != cons.w &&
           cons.buf[(cons.e-1) % INPUT_BUF] != '\n'){
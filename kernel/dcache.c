@@ -0,0 +1,179 @@
+// Directory name cache.
+//
+// Remembers the results of directory lookups, (directory,
+// name) -> inum, so that namex() can resolve path elements
+// without locking and reading each directory.  A negative entry
+// (inum 0) records that a name is not in a directory.
+//
+// The cache has to agree with the directory contents:
+// * dirlookup() enters what it found (or did not find) while
+//   holding the directory's lock.
+// * dirlink() and unlink enter the new name or a negative entry
+//   while holding the directory's lock.
+// * iput() purges a directory's entries when it frees the
+//   directory, so that a recycled inum starts with none.
+//
+// Interface:
+// * dcache_lookup(dp, name, &ip) returns 1 if name is cached,
+//   with ip the referenced inode or 0 if name is not in dp.
+// * dcache_enter(dp, name, inum) records a lookup result.
+// * dcache_purge(dev, inum) forgets directory inum.
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+#define NDENTRY  256
+#define NDHASH    61
+
+struct dentry {
+  uint dev;
+  uint dinum;        // directory, or 0 if the entry is unused
+  char name[DIRSIZ];
+  uint inum;         // 0 for a negative entry
+  uint lastuse;
+  struct dentry *next;  // hash chain
+};
+
+static struct {
+  struct spinlock lock;
+  struct dentry dentry[NDENTRY];
+  struct dentry *hash[NDHASH];
+  int hits, neghits, misses;
+} dcache;
+
+void
+dcacheinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+static int
+dhash(uint dev, uint dinum, char *name)
+{
+  uint h = dev*31 + dinum;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++)
+    h = h*31 + (uchar)name[i];
+  return h % NDHASH;
+}
+
+// Find the entry for (dev, dinum, name).
+// Caller holds dcache.lock.
+static struct dentry*
+dfind(uint dev, uint dinum, char *name)
+{
+  struct dentry *d;
+
+  for(d = dcache.hash[dhash(dev, dinum, name)]; d; d = d->next){
+    if(d->dev == dev && d->dinum == dinum && namecmp(d->name, name) == 0)
+      return d;
+  }
+  return 0;
+}
+
+// Take d off its hash chain.
+// Caller holds dcache.lock.
+static void
+dunhash(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = &dcache.hash[dhash(d->dev, d->dinum, d->name)]; *pp; pp = &(*pp)->next){
+    if(*pp == d){
+      *pp = d->next;
+      break;
+    }
+  }
+  d->dinum = 0;
+}
+
+// Look up name in directory dp, which need not be locked.
+// Returns 0 if the cache does not know.  Otherwise returns 1
+// and sets *ipp to the inode, with a new reference, or to 0
+// if dp has no such name.  The inode is taken while the entry
+// is known to be current, so it cannot be freed in between.
+int
+dcache_lookup(struct inode *dp, char *name, struct inode **ipp)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) == 0){
+    dcache.misses++;
+    release(&dcache.lock);
+    return 0;
+  }
+  d->lastuse = ticks;
+  if(d->inum){
+    dcache.hits++;
+    *ipp = iget(dp->dev, d->inum);
+  } else {
+    dcache.neghits++;
+    *ipp = 0;
+  }
+  release(&dcache.lock);
+  return 1;
+}
+
+// Record that name in directory dp is inum, or is absent if
+// inum is 0.  Caller holds dp->lock.
+void
+dcache_enter(struct inode *dp, char *name, uint inum)
+{
+  struct dentry *d, *victim;
+  int h;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) == 0){
+    // recycle an unused entry, or else the least recently used.
+    victim = 0;
+    for(d = dcache.dentry; d < &dcache.dentry[NDENTRY]; d++){
+      if(d->dinum == 0){
+        victim = d;
+        break;
+      }
+      if(victim == 0 || d->lastuse < victim->lastuse)
+        victim = d;
+    }
+    d = victim;
+    if(d->dinum)
+      dunhash(d);
+    d->dev = dp->dev;
+    d->dinum = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    h = dhash(d->dev, d->dinum, d->name);
+    d->next = dcache.hash[h];
+    dcache.hash[h] = d;
+  }
+  d->inum = inum;
+  d->lastuse = ticks;
+  release(&dcache.lock);
+}
+
+// Forget every entry of directory dinum, which is being freed.
+void
+dcache_purge(uint dev, uint dinum)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.dentry; d < &dcache.dentry[NDENTRY]; d++){
+    if(d->dinum == dinum && d->dev == dev)
+      dunhash(d);
+  }
+  release(&dcache.lock);
+}
+
+// Print hit counters.  For debugging.
+void
+dcachestats(void)
+{
+  printf("dcache: hits %d negative hits %d misses %d\n",
+         dcache.hits, dcache.neghits, dcache.misses);
+}
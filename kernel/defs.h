@@ -2,6 +2,7 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
 struct pipe;
 struct proc;
 struct spinlock;
@@ -16,8 +17,12 @@ struct sock;
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+void            breadv(uint, uint, int, struct buf**);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwritev(struct buf**, int);
+void            bprefetch(uint, uint, int);
+void            bstats(void);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
 
@@ -26,8 +31,16 @@ void            consoleinit(void);
 void            consoleintr(int);
 void            consputc(int);
 
+// dcache.c
+void            dcacheinit(void);
+int             dcache_lookup(struct inode*, char*, struct inode**);
+void            dcache_enter(struct inode*, char*, uint);
+void            dcache_purge(uint, uint);
+void            dcachestats(void);
+
 // exec.c
 int             exec(char*, char**);
+int             execproc(struct proc*, char*, char**);
 
 // file.c
 struct file*    filealloc(void);
@@ -40,10 +53,13 @@ int             filewrite(struct file*, uint64, int n);
 
 // fs.c
 void            fsinit(int);
+int             dirinit(struct inode*, uint);
 int             dirlink(struct inode*, char*, uint);
+int             dirlinkcost(void);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+struct inode*   iget(uint, uint);
 void            iinit();
 void            ilock(struct inode*);
 void            iput(struct inode*);
@@ -56,7 +72,9 @@ struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
-void            itrunc(struct inode*);
+void            ireclaim(void);
+int             itruncstep(struct inode*);
+void            itruncate(struct inode*);
 
 // ramdisk.c
 void            ramdiskinit(void);
@@ -65,16 +83,38 @@ void            ramdiskrw(struct buf*);
 
 // kalloc.c
 void*           kalloc(void);
+void*           kzalloc(void);
+void*           kallocn(int);
 void            kfree(void *);
+void            kdup(void *);
+int             krefcnt(void *);
 void            kinit(void);
 
+// slab.c
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+void            slabstats(void);
+
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
+void            begin_opn(int);
 void            end_op(void);
+int             log_writecost(int);
+int             log_maxwrite(void);
+
+// pcache.c
+void            pcacheinit(void);
+char*           pcache_get(struct inode*, uint);
+void            pcache_write(struct inode*, uint, char*, uint);
+void            pcache_drop(struct inode*);
+void            pcachestats(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -89,11 +129,13 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             spawn(char*, char**, int*, int);
 int             growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
+void            kthread(char*, void (*)(void));
 struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
 struct proc*    myproc();
@@ -173,9 +215,12 @@ void            uvminit(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmshare(pagetable_t, pagetable_t, uint64, uint64, int);
+int             uvmcow(pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+pte_t*          walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
@@ -187,9 +232,21 @@ void            plicinithart(void);
 int             plic_claim(void);
 void            plic_complete(int);
 
+// vma.c
+uint64          vmmap(uint64, int, int, struct inode*, uint);
+int             vmunmap(uint64, uint64);
+int             vmfault(struct proc*, uint64, int);
+void            vmprefault(uint64, uint64, int);
+int             vmafork(struct proc*, struct proc*);
+void            vmafree(struct proc*);
+void            vmatrim(struct proc*, uint64, uint64);
+uint64          vmabase(struct proc*);
+
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_submit(struct buf **, int, int);
+void            virtio_disk_wait(struct buf *);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
@@ -221,11 +278,16 @@ void            pci_init();
 // e1000.c
 void            e1000_init(uint32 *);
 void            e1000_intr(void);
-int             e1000_transmit(struct mbuf*);
+int             e1000_transmit(struct mbuf*, int);
+int             e1000_transmit_batch(struct mbuf**, int, int);
+void            e1000_pollinit(void);
+void            e1000stats(void);
 
 // net.c
+void            mbufinit(void);
+void            mbufstats(void);
 void            net_rx(struct mbuf*);
-void            net_tx_udp(struct mbuf*, uint32, uint16, uint16);
+int             net_tx_udp(struct mbuf*, uint32, uint16, uint16);
 
 // sysnet.c
 void            sockinit(void);
@@ -234,4 +296,5 @@ void            sockclose(struct sock *);
 int             sockread(struct sock *, uint64, int);
 int             sockwrite(struct sock *, uint64, int);
 void            sockrecvudp(struct mbuf*, uint32, uint16, uint16);
+void            sockstats(void);
 #endif
@@ -8,19 +8,88 @@
 #include "e1000_dev.h"
 #include "net.h"
 
-#define TX_RING_SIZE 16
-static struct tx_desc tx_ring[TX_RING_SIZE] __attribute__((aligned(16)));
-static struct mbuf *tx_mbufs[TX_RING_SIZE];
+// Ring sizes, in descriptors.  Build with E1000_TXRING=n or
+// E1000_RXRING=n to change them.  Each must be a multiple of 8,
+// since the e1000 wants ring lengths in multiples of 128 bytes,
+// and at most E1000_MAXRING.
+#ifndef E1000_TXRING
+#define E1000_TXRING 256
+#endif
+#ifndef E1000_RXRING
+#define E1000_RXRING 256
+#endif
+#define E1000_MAXRING 4096
 
-#define RX_RING_SIZE 16
-static struct rx_desc rx_ring[RX_RING_SIZE] __attribute__((aligned(16)));
-static struct mbuf *rx_mbufs[RX_RING_SIZE];
+// The rings and the mbufs they point to come from kallocn(),
+// since the e1000 reads the rings by physical address.
+//
+// Transmit descriptors from tx_clean up to tx_tail hold mbufs
+// that the e1000 may not have sent yet; it has been told about
+// those up to tx_rung (the last value written to TDT).
+static int tx_ring_size = E1000_TXRING;
+static struct tx_desc *tx_ring;
+static struct mbuf **tx_mbufs;
+static uint tx_tail;    // the next descriptor to fill
+static uint tx_rung;    // the e1000's TDT
+static uint tx_clean;   // the oldest descriptor not yet reaped
+static int tx_waiting;  // someone sleeps in e1000_transmit_batch()
+
+static int rx_ring_size = E1000_RXRING;
+static struct rx_desc *rx_ring;
+static struct mbuf **rx_mbufs;
+static uint rx_tail;    // the last descriptor given to the e1000
+
+// Receive interrupt delays, in units of 1.024 usec: the e1000
+// waits RDTR after a packet for another before interrupting,
+// but no more than RADV after the first.  Build with
+// E1000_RDTR=n or E1000_RADV=n to tune them.  TIDV likewise
+// delays the interrupt for sent packets.
+#ifndef E1000_RDTR
+#define E1000_RDTR 16
+#endif
+#ifndef E1000_RADV
+#define E1000_RADV 64
+#endif
+#ifndef E1000_TIDV
+#define E1000_TIDV 64
+#endif
+
+// Packets delivered per pass of the polling thread.
+#define E1000_BUDGET 64
+
+#define E1000_INTRS (E1000_ICR_RXT0 | E1000_ICR_TXDW)
+
+// Received packets and sent ones are handled by a kernel thread,
+// not by the interrupt handler.  An interrupt masks further
+// interrupts and sets poll_pending to wake e1000_poll(), which
+// unmasks them once it has emptied the receive ring.
+static int poll_pending;
+
+static struct {
+  int intr;    // interrupts
+  int polls;   // passes of e1000_poll()
+  int rx;      // packets received
+  int rxdrop;  // received packets dropped for lack of mbufs
+  int tx;      // packets queued for sending
+  int txkick;  // writes to TDT
+} stats;
 
 // remember where the e1000's registers live.
 static volatile uint32 *regs;
 
 struct spinlock e1000_lock;
 
+// Allocate n bytes of zeroed, physically contiguous memory.
+static void *
+ringalloc(uint64 n)
+{
+  void *p;
+
+  if((p = kallocn(PGROUNDUP(n) / PGSIZE)) == 0)
+    panic("e1000: ring alloc");
+  return p;
+}
+
 // called by pci_init().
 // xregs is the memory address at which the
 // e1000's registers are mapped.
@@ -31,6 +100,14 @@ e1000_init(uint32 *xregs)
 
   initlock(&e1000_lock, "e1000");
 
+  if(tx_ring_size <= 0 || tx_ring_size > E1000_MAXRING || tx_ring_size % 8 != 0 ||
+     rx_ring_size <= 0 || rx_ring_size > E1000_MAXRING || rx_ring_size % 8 != 0)
+    panic("e1000: ring size");
+  tx_ring = ringalloc(tx_ring_size * sizeof(struct tx_desc));
+  tx_mbufs = ringalloc(tx_ring_size * sizeof(struct mbuf *));
+  rx_ring = ringalloc(rx_ring_size * sizeof(struct rx_desc));
+  rx_mbufs = ringalloc(rx_ring_size * sizeof(struct mbuf *));
+
   regs = xregs;
 
   // Reset the device
@@ -40,31 +117,25 @@ e1000_init(uint32 *xregs)
   __sync_synchronize();
 
   // [E1000 14.5] Transmit initialization
-  memset(tx_ring, 0, sizeof(tx_ring));
-  for (i = 0; i < TX_RING_SIZE; i++) {
+  for (i = 0; i < tx_ring_size; i++)
     tx_ring[i].status = E1000_TXD_STAT_DD;
-    tx_mbufs[i] = 0;
-  }
   regs[E1000_TDBAL] = (uint64) tx_ring;
-  if(sizeof(tx_ring) % 128 != 0)
-    panic("e1000");
-  regs[E1000_TDLEN] = sizeof(tx_ring);
+  regs[E1000_TDLEN] = tx_ring_size * sizeof(struct tx_desc);
   regs[E1000_TDH] = regs[E1000_TDT] = 0;
+  regs[E1000_TIDV] = E1000_TIDV;
 
   // [E1000 14.4] Receive initialization
-  memset(rx_ring, 0, sizeof(rx_ring));
-  for (i = 0; i < RX_RING_SIZE; i++) {
+  for (i = 0; i < rx_ring_size; i++) {
     rx_mbufs[i] = mbufalloc(0);
     if (!rx_mbufs[i])
       panic("e1000");
     rx_ring[i].addr = (uint64) rx_mbufs[i]->head;
   }
   regs[E1000_RDBAL] = (uint64) rx_ring;
-  if(sizeof(rx_ring) % 128 != 0)
-    panic("e1000");
   regs[E1000_RDH] = 0;
-  regs[E1000_RDT] = RX_RING_SIZE - 1;
-  regs[E1000_RDLEN] = sizeof(rx_ring);
+  rx_tail = rx_ring_size - 1;
+  regs[E1000_RDT] = rx_tail;
+  regs[E1000_RDLEN] = rx_ring_size * sizeof(struct rx_desc);
 
   // filter by qemu's MAC address, 52:54:00:12:34:56
   regs[E1000_RA] = 0x12005452;
@@ -83,74 +154,200 @@ e1000_init(uint32 *xregs)
   // receiver control bits.
   regs[E1000_RCTL] = E1000_RCTL_EN | // enable receiver
     E1000_RCTL_BAM |                 // enable broadcast
-    E1000_RCTL_SZ_2048 |             // 2048-byte rx buffers
+    E1000_RCTL_SZ_2048 |             // 2048-byte rx buffers; without
+                                     // LPE no frame exceeds MBUF_SIZE
     E1000_RCTL_SECRC;                // strip CRC
 
-  // ask e1000 for receive interrupts.
-  regs[E1000_RDTR] = 0; // interrupt after every received packet (no timer)
-  regs[E1000_RADV] = 0; // interrupt after every packet (no timer)
-  regs[E1000_IMS] = (1 << 7); // RXDW -- Receiver Descriptor Write Back
+  // ask e1000 for receive and transmit interrupts, coalesced by
+  // the timers.
+  regs[E1000_RDTR] = E1000_RDTR;
+  regs[E1000_RADV] = E1000_RADV; // only used if RDTR is not 0
+  regs[E1000_IMS] = E1000_INTRS;
 }
 
-int
-e1000_transmit(struct mbuf *m)
+// The number of free transmit descriptors.  One is always left
+// empty, since TDT == TDH means the ring is empty.
+// Caller holds e1000_lock.
+static int
+txfree(void)
 {
-  //
-  // Your code here.
-  //
-  // the mbuf contains an ethernet frame; program it into
-  // the TX descriptor ring so that the e1000 sends it. Stash
-  // a pointer so that it can be freed after sending.
-  //
-  acquire(&e1000_lock);
+  return tx_ring_size - 1 - (tx_tail - tx_clean + tx_ring_size) % tx_ring_size;
+}
+
+// Tell the e1000 about the descriptors filled since the last
+// time.  Each write to TDT is a costly trip to the device, so
+// this is done only when the e1000 has sent everything it was
+// told about: otherwise its interrupt for those packets will
+// lead e1000_poll() to call txreap(), which calls txkick().
+// Caller holds e1000_lock.
+static void
+txkick(void)
+{
+  if(tx_rung == tx_tail || tx_clean != tx_rung)
+    return;
+  __sync_synchronize();
+  regs[E1000_TDT] = tx_tail;
+  tx_rung = tx_tail;
+  stats.txkick++;
+}
+
+// Free the mbufs of all the packets the e1000 has sent, pass on
+// any that were queued meanwhile, and wake senders waiting for
+// room.  Caller holds e1000_lock.
+static void
+txreap(void)
+{
+  int n = 0;
 
-  uint tail = regs[E1000_TDT];
-  struct tx_desc *desc = &tx_ring[tail];
-  if(!(desc->status & E1000_TXD_STAT_DD)) {
-    goto T_WRONG;
+  while(tx_clean != tx_rung && (tx_ring[tx_clean].status & E1000_TXD_STAT_DD)) {
+    mbuffree(tx_mbufs[tx_clean]);
+    tx_mbufs[tx_clean] = 0;
+    tx_clean = (tx_clean + 1) % tx_ring_size;
+    n++;
   }
-  if(tx_mbufs[tail]) {
-    mbuffree(tx_mbufs[tail]);
-    tx_mbufs[tail] = 0;
+  txkick();
+  if(n > 0 && tx_waiting) {
+    tx_waiting = 0;
+    wakeup(&tx_waiting);
   }
-  desc->cmd = E1000_TXD_CMD_EOP | E1000_TXD_CMD_RS;
-  desc->addr = (uint64)m->head;
-  desc->length = m->len;
+}
 
-  tx_mbufs[tail] = m;
-  regs[E1000_TDT] = (regs[E1000_TDT] + 1) % TX_RING_SIZE;
-  release(&e1000_lock);
-  return 0;
-T_WRONG:
+// Queue the n ethernet frames in ms for sending, telling the
+// e1000 about them with (at most) one write to TDT; the driver
+// frees each mbuf once the e1000 is done with it.  Returns the
+// number of frames queued, which is less than n if the ring is
+// full; the caller still owns the rest.  If wait is set, sleeps
+// for free descriptors instead, and stops early only if the
+// process is killed; the caller must hold no spinlocks.
+int
+e1000_transmit_batch(struct mbuf **ms, int n, int wait)
+{
+  struct proc *p = myproc();
+  struct tx_desc *desc;
+  int i;
+
+  acquire(&e1000_lock);
+  i = 0;
+  while(i < n) {
+    if(txfree() == 0)
+      txreap();
+    if(txfree() == 0) {
+      if(!wait || p->killed)
+        break;
+      // make sure the e1000 is working through the ring.
+      txkick();
+      tx_waiting = 1;
+      sleep(&tx_waiting, &e1000_lock);
+      continue;
+    }
+    desc = &tx_ring[tx_tail];
+    desc->addr = (uint64)ms[i]->head;
+    desc->length = ms[i]->len;
+    desc->cmd = E1000_TXD_CMD_EOP | E1000_TXD_CMD_RS | E1000_TXD_CMD_IDE;
+    desc->status = 0;
+    tx_mbufs[tx_tail] = ms[i];
+    tx_tail = (tx_tail + 1) % tx_ring_size;
+    stats.tx++;
+    i++;
+  }
+  // reaping is cheap, and lets txkick() start the e1000 now if
+  // it has already sent the earlier packets.
+  txreap();
   release(&e1000_lock);
-  return -1;
+  return i;
 }
 
-static void
-e1000_recv(void)
+// Queue the ethernet frame in m for sending.  Returns 0, or -1
+// if the ring is full and the caller still owns m.
+int
+e1000_transmit(struct mbuf *m, int wait)
+{
+  return e1000_transmit_batch(&m, 1, wait) == 1 ? 0 : -1;
+}
+
+// Deliver up to budget received packets to the network stack,
+// and give their descriptors back to the e1000 with new mbufs.
+// Returns the number of packets handled.  Called only by
+// e1000_poll(), so it needs no lock.
+static int
+e1000_recv(int budget)
 {
-  //
-  // Your code here.
-  //
-  // Check for packets that have arrived from the e1000
-  // Create and deliver an mbuf for each packet (using net_rx()).
-  //
-R_START:
-  uint tail = (regs[E1000_RDT] + 1) % RX_RING_SIZE;
-  struct rx_desc *desc = &rx_ring[tail];
-  if(!(desc->status & E1000_RXD_STAT_DD)){
-      return;
+  struct rx_desc *desc;
+  struct mbuf *m;
+  uint tail;
+  int n;
+
+  for(n = 0; n < budget; n++) {
+    tail = (rx_tail + 1) % rx_ring_size;
+    desc = &rx_ring[tail];
+    if(!(desc->status & E1000_RXD_STAT_DD))
+      break;
+
+    m = rx_mbufs[tail];
+    if((rx_mbufs[tail] = mbufalloc(0)) == 0) {
+      // drop the packet and let the e1000 reuse its mbuf.
+      rx_mbufs[tail] = m;
+      stats.rxdrop++;
+    } else {
+      m->len = desc->length;
+      net_rx(m);
+      stats.rx++;
+    }
+    desc->addr = (uint64)rx_mbufs[tail]->head;
+    desc->status = 0;
+    rx_tail = tail;
   }
 
-  rx_mbufs[tail]->len = desc->length;
-  net_rx(rx_mbufs[tail]);
+  // hand the refilled descriptors back all at once.
+  if(n > 0) {
+    __sync_synchronize();
+    regs[E1000_RDT] = rx_tail;
+  }
+  return n;
+}
+
+// The polling thread.  Delivers received packets E1000_BUDGET
+// at a time, yielding the CPU between passes, so that a flood of
+// packets leaves time for processes to consume them instead of
+// keeping the CPU in the interrupt handler.  Also reaps sent
+// packets on each pass.
+static void
+e1000_poll(void)
+{
+  acquire(&e1000_lock);
+  for(;;) {
+    while(!poll_pending)
+      sleep(&poll_pending, &e1000_lock);
+    txreap();
+    release(&e1000_lock);
+
+    stats.polls++;
+    if(e1000_recv(E1000_BUDGET) == E1000_BUDGET) {
+      yield();
+      acquire(&e1000_lock);
+      continue;
+    }
 
-  rx_mbufs[tail] = mbufalloc(0);
-  desc->addr = (uint64)rx_mbufs[tail]->head;
-  desc->status = 0;
-  regs[E1000_RDT] = tail;
+    // the receive ring is empty; wait for the next interrupt.
+    // a packet that arrived or was sent before the unmask
+    // doesn't raise one if e1000_intr() already cleared its
+    // cause, so look again.
+    acquire(&e1000_lock);
+    poll_pending = 0;
+    regs[E1000_IMS] = E1000_INTRS;
+    if(rx_ring[(rx_tail + 1) % rx_ring_size].status & E1000_RXD_STAT_DD)
+      poll_pending = 1;
+    if(tx_clean != tx_rung && (tx_ring[tx_clean].status & E1000_TXD_STAT_DD))
+      poll_pending = 1;
+  }
+}
 
-  goto R_START;
+// Start the polling thread, if there is an e1000.
+void
+e1000_pollinit(void)
+{
+  if(regs)
+    kthread("e1000poll", e1000_poll);
 }
 
 void
@@ -159,7 +356,26 @@ e1000_intr(void)
   // tell the e1000 we've seen this interrupt;
   // without this the e1000 won't raise any
   // further interrupts.
+  uint32 icr = regs[E1000_ICR];
   regs[E1000_ICR] = 0xffffffff;
 
-  e1000_recv();
+  acquire(&e1000_lock);
+  stats.intr++;
+  if(icr & E1000_INTRS) {
+    // leave the packets to e1000_poll(), with interrupts off
+    // until it has emptied the receive ring.
+    regs[E1000_IMC] = E1000_INTRS;
+    poll_pending = 1;
+    wakeup(&poll_pending);
+  }
+  release(&e1000_lock);
+}
+
+// Print packet counters.  For debugging.
+void
+e1000stats(void)
+{
+  printf("e1000: intr %d polls %d rx %d rxdrop %d tx %d txkick %d\n",
+         stats.intr, stats.polls, stats.rx, stats.rxdrop,
+         stats.tx, stats.txkick);
 }
@@ -33,7 +33,15 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  struct extent ext[NEXTENT];
+  uint dindirect;
+
+  uint ra_next;       // readahead: file block a sequential read would start at
+  uint ra_win;        // readahead window in blocks; 0 if not sequential
+  uint ra_end;        // readahead: blocks before this have been prefetched
+
+  struct inode *next; // inode cache hash chain
+  struct inode *freenext; // proc's list of inodes to free (see iput())
 };
 
 // map major device number to device functions.
@@ -22,10 +22,16 @@
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+#define RA_MIN  4   // initial readahead window, in blocks
+#define RA_MAX 32   // largest readahead window
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
 
+static void bsuminit(int);
+
 // Read the super block.
 static void
 readsb(int dev, struct superblock *sb)
@@ -44,6 +50,7 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  bsuminit(dev);
 }
 
 // Zero a block.
@@ -60,29 +67,119 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
-static uint
-balloc(uint dev)
+// In-memory summary of the free bitmap: the number of free
+// blocks covered by each bitmap block, so that balloc() can
+// skip full bitmap blocks without reading them.  The bitmap
+// blocks themselves remain the truth; a bitmap buf's lock is
+// held while its bits and its count change.
+static struct {
+  struct spinlock lock;
+  int nbmap;          // number of bitmap blocks
+  int *nfree;         // free blocks per bitmap block
+  uint rotor;         // where allocations without a goal start
+} bsum;
+
+// Count the free blocks under each bitmap block.
+static void
+bsuminit(int dev)
 {
-  int b, bi, m;
   struct buf *bp;
-
-  bp = 0;
+  int b, bi;
+
+  initlock(&bsum.lock, "bsum");
+  bsum.nbmap = (sb.size + BPB - 1) / BPB;
+  if(bsum.nbmap > PGSIZE / sizeof(int))
+    panic("bsuminit: file system too big");
+  if((bsum.nfree = kzalloc()) == 0)
+    panic("bsuminit");
   for(b = 0; b < sb.size; b += BPB){
     bp = bread(dev, BBLOCK(b, sb));
     for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        bsum.nfree[b / BPB]++;
+    }
+    brelse(bp);
+  }
+  bsum.rotor = sb.bmapstart;
+}
+
+// Allocate up to n consecutive zeroed disk blocks and return
+// the first; *got is set to how many.  The run starts at the
+// first free block at or after goal within goal's bitmap block
+// if there is one, so a file's next block usually lands right
+// after its previous one.  Otherwise, and when goal is 0, it
+// starts at the first free block in the next bitmap block with
+// free space, going on from the most recent allocation.
+// Returns 0 if the disk is full.
+static uint
+balloc(uint dev, uint goal, uint n, uint *got)
+{
+  int k, bi, len, nfree;
+  uint b, bmap, start;
+  struct buf *bp;
+
+  if(goal == 0 || goal >= sb.size)
+    goal = bsum.rotor;
+
+  // goal's bitmap block from goal on, then the following ones,
+  // then goal's bitmap block again from its start.
+  for(k = 0; k <= bsum.nbmap; k++){
+    bmap = (goal / BPB + k) % bsum.nbmap;
+    acquire(&bsum.lock);
+    nfree = bsum.nfree[bmap];
+    release(&bsum.lock);
+    if(nfree == 0)
+      continue;
+
+    b = bmap * BPB;
+    bp = bread(dev, BBLOCK(b, sb));
+    for(bi = (k == 0) ? goal % BPB : 0; bi < BPB && b + bi < sb.size; bi++){
+      if(bi % 8 == 0 && bp->data[bi/8] == 0xff){
+        bi += 7;  // skip a full byte
+        continue;
       }
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        break;
     }
+    if(bi >= BPB || b + bi >= sb.size){
+      brelse(bp);
+      continue;
+    }
+
+    // take bi and as many free blocks after it as wanted.
+    for(len = 0; len < n && bi + len < BPB && b + bi + len < sb.size; len++){
+      int m = 1 << ((bi + len) % 8);
+      if(bp->data[(bi + len)/8] & m)
+        break;
+      bp->data[(bi + len)/8] |= m;  // Mark block in use.
+    }
+    log_write(bp);
     brelse(bp);
+
+    start = b + bi;
+    acquire(&bsum.lock);
+    bsum.nfree[bmap] -= len;
+    bsum.rotor = start + len;
+    release(&bsum.lock);
+
+    for(int i = 0; i < len; i++)
+      bzero(dev, start + i);
+    *got = len;
+    return start;
   }
-  panic("balloc: out of blocks");
+  printf("balloc: out of blocks\n");
+  *got = 0;
+  return 0;
+}
+
+// Allocate one zeroed disk block, preferably goal.
+// Returns 0 if the disk is full.
+static uint
+balloc1(uint dev, uint goal)
+{
+  uint got;
+
+  return balloc(dev, goal, 1, &got);
 }
 
 // Free a disk block.
@@ -99,6 +196,9 @@ bfree(int dev, uint b)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
   log_write(bp);
+  acquire(&bsum.lock);
+  bsum.nfree[b / BPB]++;
+  release(&bsum.lock);
   brelse(bp);
 }
 
@@ -127,18 +227,18 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a cache entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in cache: ip->ref tracks the number of
+//   in-memory pointers to a cache entry (open files and
+//   current directories). iget() finds or creates a cache
+//   entry and increments its ref; iput() decrements ref and
+//   removes the entry when ref reaches zero.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
-//   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   the disk and sets ip->valid.  iput() frees a cache
+//   entry whose ip->ref has fallen to zero, so a later
+//   iget() starts with ip->valid 0.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -162,32 +262,42 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// The cache is a hash table of in-memory inodes keyed by
+// (dev, inum).  Entries come from a kmem_cache when iget()
+// first needs them and go back to it when their ref falls to
+// zero, so the number of active inodes is limited only by
+// memory.  Each bucket's spin-lock protects its chain and the
+// ref of the inodes on it; ip->dev and ip->inum do not change
+// while an inode is in the cache.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
-// dev, and inum.  One must hold ip->lock in order to
+// dev, inum, and next.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIBUCKET 31
+
 struct {
-  struct spinlock lock;
-  struct inode inode[NINODE];
+  struct kmem_cache *cache;
+  struct {
+    struct spinlock lock;
+    struct inode *head;
+  } bucket[NIBUCKET];
 } icache;
 
+static int
+ihash(uint dev, uint inum)
+{
+  return (dev*31 + inum) % NIBUCKET;
+}
+
 void
 iinit()
 {
-  int i = 0;
-  
-  initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  icache.cache = kmem_cache_create("inode", sizeof(struct inode));
+  for(int i = 0; i < NIBUCKET; i++)
+    initlock(&icache.bucket[i].lock, "icache.bucket");
 }
 
-static struct inode* iget(uint dev, uint inum);
 
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
@@ -231,7 +341,8 @@ iupdate(struct inode *ip)
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
-  memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
+  memmove(dip->ext, ip->ext, sizeof(ip->ext));
+  dip->dindirect = ip->dindirect;
   log_write(bp);
   brelse(bp);
 }
@@ -239,35 +350,34 @@ iupdate(struct inode *ip)
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
-static struct inode*
+struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
+  int h = ihash(dev, inum);
 
-  acquire(&icache.lock);
+  acquire(&icache.bucket[h].lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+  for(ip = icache.bucket[h].head; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
       ip->ref++;
-      release(&icache.lock);
+      release(&icache.bucket[h].lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
+  // Not cached; make a new entry.
+  if((ip = kmem_cache_alloc(icache.cache)) == 0)
     panic("iget: no inodes");
-
-  ip = empty;
+  memset(ip, 0, sizeof(*ip));
+  initsleeplock(&ip->lock, "inode");
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
-  ip->valid = 0;
-  release(&icache.lock);
+  ip->next = icache.bucket[h].head;
+  icache.bucket[h].head = ip;
+  release(&icache.bucket[h].lock);
 
   return ip;
 }
@@ -277,9 +387,11 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&icache.lock);
+  int h = ihash(ip->dev, ip->inum);
+
+  acquire(&icache.bucket[h].lock);
   ip->ref++;
-  release(&icache.lock);
+  release(&icache.bucket[h].lock);
   return ip;
 }
 
@@ -304,7 +416,8 @@ ilock(struct inode *ip)
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+    memmove(ip->ext, dip->ext, sizeof(ip->ext));
+    ip->dindirect = dip->dindirect;
     brelse(bp);
     ip->valid = 1;
     if(ip->type == 0)
@@ -326,35 +439,71 @@ iunlock(struct inode *ip)
 // If that was the last reference, the inode cache entry can
 // be recycled.
 // If that was the last reference and the inode has no links
-// to it, free the inode (and its content) on disk.
+// to it, free the inode (and its content) on disk, once the
+// caller's transaction ends: a big file takes several
+// transactions to truncate (see ireclaim()).
 // All calls to iput() must be inside a transaction in
 // case it has to free the inode.
 void
 iput(struct inode *ip)
 {
-  acquire(&icache.lock);
+  struct proc *p = myproc();
+  struct inode **pp;
+  int h = ihash(ip->dev, ip->inum);
+
+  acquire(&icache.bucket[h].lock);
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
-    // inode has no links and no other references: truncate and free.
+    // inode has no links and no other references: hand the
+    // reference to end_op(), which frees the inode.
+    ip->freenext = p->ifree;
+    p->ifree = ip;
+    release(&icache.bucket[h].lock);
+    return;
+  }
+
+  if(--ip->ref > 0){
+    release(&icache.bucket[h].lock);
+    return;
+  }
 
-    // ip->ref == 1 means no other process can have ip locked,
-    // so this acquiresleep() won't block (or deadlock).
-    acquiresleep(&ip->lock);
+  // last reference: drop the entry from the cache.
+  for(pp = &icache.bucket[h].head; *pp != ip; pp = &(*pp)->next)
+    ;
+  *pp = ip->next;
+  release(&icache.bucket[h].lock);
+  kmem_cache_free(icache.cache, ip);
+}
 
-    release(&icache.lock);
+// Free the inodes whose last references this process dropped
+// in the transaction that just ended.  Called by end_op(),
+// outside any transaction.  Nothing else can reach the inodes,
+// so the truncation may span transactions; a crash part way
+// leaves an unlinked inode holding the rest of its blocks, as
+// it would have before the unlink.
+void
+ireclaim(void)
+{
+  struct proc *p = myproc();
+  struct inode *ip, *list;
 
-    itrunc(ip);
+  list = p->ifree;
+  p->ifree = 0;
+  while((ip = list) != 0){
+    list = ip->freenext;
+    itruncate(ip);
+
+    begin_op();
+    ilock(ip);
+    if(ip->type == T_DIR)
+      dcache_purge(ip->dev, ip->inum);
     ip->type = 0;
     iupdate(ip);
     ip->valid = 0;
-
-    releasesleep(&ip->lock);
-
-    acquire(&icache.lock);
+    iunlock(ip);
+    iput(ip);
+    end_op();
   }
-
-  ip->ref--;
-  release(&icache.lock);
 }
 
 // Common idiom: unlock, then put.
@@ -368,72 +517,210 @@ iunlockput(struct inode *ip)
 // Inode content
 //
 // The content (data) associated with each inode is stored
-// in blocks on the disk. The first NDIRECT block numbers
-// are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// in blocks on the disk. ip->ext[] lists runs of consecutive
+// blocks holding the start of the file.  Appended blocks go
+// at the end of the last extent if the disk blocks after it are
+// free, and otherwise start a new extent; a write that appends
+// several blocks allocates them as one run.  Once the extents
+// run out, the rest of the file is mapped through the
+// doubly-indirect block ip->dindirect, and the extents stop
+// growing.
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bmap allocates one, and if it is
+// appended to the extents, allocates up to want blocks from bn
+// on (the blocks the caller is about to write) along with it.
+// Returns 0 if the disk is full.
 static uint
-bmap(struct inode *ip, uint bn)
+bmap(struct inode *ip, uint bn, uint want)
 {
-  uint addr, *a;
+  uint addr, start, ind, got, *a;
   struct buf *bp;
-
-  if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
-    return addr;
+  struct extent *e;
+  int i;
+
+  start = 0;
+  for(i = 0; i < NEXTENT && ip->ext[i].len; i++){
+    e = &ip->ext[i];
+    if(bn < start + e->len)
+      return e->addr + (bn - start);
+    start += e->len;
+  }
+  // start is now the number of blocks in extents.
+
+  addr = 0;
+  if(bn == start && ip->dindirect == 0){
+    // Appending: grow the last extent if we can.
+    if(i > 0){
+      e = &ip->ext[i-1];
+      if((addr = balloc(ip->dev, e->addr + e->len, want, &got)) == 0)
+        return 0;
+      if(addr == e->addr + e->len){
+        e->len += got;
+        return addr;
+      }
+    } else if((addr = balloc(ip->dev, 0, want, &got)) == 0){
+      return 0;
+    }
+    if(i < NEXTENT){
+      ip->ext[i].addr = addr;
+      ip->ext[i].len = got;
+      return addr;
+    }
+    // Out of extents; addr becomes the first block
+    // under the doubly-indirect block.
+    while(got > 1)
+      bfree(ip->dev, addr + --got);
   }
-  bn -= NDIRECT;
+  bn -= start;
+
+  if(bn < NINDIRECT * NINDIRECT){
+    // Load doubly-indirect block, allocating if necessary.
+    if(ip->dindirect == 0 && (ip->dindirect = balloc1(ip->dev, 0)) == 0)
+      goto bad;
+    bp = bread(ip->dev, ip->dindirect);
+    a = (uint*)bp->data;
+    if((ind = a[bn / NINDIRECT]) == 0){
+      if((ind = balloc1(ip->dev, ip->dindirect + 1)) == 0){
+        brelse(bp);
+        goto bad;
+      }
+      a[bn / NINDIRECT] = ind;
+      log_write(bp);
+    }
+    brelse(bp);
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
+    // Then the indirect block.
+    bp = bread(ip->dev, ind);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+    if(a[bn % NINDIRECT] == 0){
+      if(addr == 0)
+        addr = balloc1(ip->dev, bn % NINDIRECT ? a[bn % NINDIRECT - 1] + 1 : ind + 1);
+      if(addr == 0){
+        brelse(bp);
+        return 0;
+      }
+      a[bn % NINDIRECT] = addr;
       log_write(bp);
+    } else if(addr){
+      panic("bmap: remap");
     }
+    addr = a[bn % NINDIRECT];
     brelse(bp);
     return addr;
   }
 
   panic("bmap: out of range");
+
+ bad:
+  if(addr)
+    bfree(ip->dev, addr);
+  return 0;
 }
 
-// Truncate inode (discard contents).
-// Caller must hold ip->lock.
-void
-itrunc(struct inode *ip)
+// Bitmap blocks that one itruncstep() may dirty: a transaction
+// of MAXOPBLOCKS also logs the i-node, the doubly-indirect block
+// and one indirect block.
+#define TRUNCBITMAP (MAXOPBLOCKS - 3)
+
+// Free block b of ip for itruncstep(), unless that would dirty
+// more than TRUNCBITMAP bitmap blocks; bm[0..*nbm-1] are the
+// ones dirtied so far.  Returns 0 if b was not freed.
+static int
+truncfree(struct inode *ip, uint b, uint *bm, int *nbm)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  uint blk = BBLOCK(b, sb);
+  int i;
 
-  for(i = 0; i < NDIRECT; i++){
-    if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
-    }
+  for(i = 0; i < *nbm && bm[i] != blk; i++)
+    ;
+  if(i == *nbm){
+    if(*nbm == TRUNCBITMAP)
+      return 0;
+    bm[(*nbm)++] = blk;
   }
+  bfree(ip->dev, b);
+  return 1;
+}
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
+// Free blocks from the end of ip, as many as fit in one
+// begin_op() transaction, and shorten ip to the blocks that are
+// left.  Returns 1 once ip has no blocks.  Since a file has no
+// holes, its blocks past the extents are the first ones under
+// the doubly-indirect block, and those go first.
+// Caller holds ip->lock, in a transaction of its own.
+int
+itruncstep(struct inode *ip)
+{
+  uint bm[TRUNCBITMAP], *a, *ia, nblk;
+  struct buf *bp, *ibp;
+  int nbm, i, j, k;
+
+  pcache_drop(ip);
+  nbm = 0;
+  nblk = 0;
+  if(ip->dindirect){
+    bp = bread(ip->dev, ip->dindirect);
     a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+    for(j = NINDIRECT - 1; j >= 0 && a[j] == 0; j--)
+      ;
+    if(j >= 0){
+      ibp = bread(ip->dev, a[j]);
+      ia = (uint*)ibp->data;
+      for(k = NINDIRECT - 1; k >= 0; k--){
+        if(ia[k] == 0)
+          continue;
+        if(!truncfree(ip, ia[k], bm, &nbm))
+          break;
+        ia[k] = 0;
+      }
+      log_write(ibp);
+      brelse(ibp);
+      // the indirect blocks before a[j] are full.
+      nblk = j*NINDIRECT + k + 1;
+      if(k < 0 && truncfree(ip, a[j], bm, &nbm)){
+        a[j] = 0;
+        log_write(bp);
+        j--;
+      }
     }
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
+    if(j < 0 && truncfree(ip, ip->dindirect, bm, &nbm))
+      ip->dindirect = 0;
+  } else {
+    for(i = NEXTENT - 1; i >= 0; i--){
+      while(ip->ext[i].len > 0 &&
+            truncfree(ip, ip->ext[i].addr + ip->ext[i].len - 1, bm, &nbm))
+        ip->ext[i].len--;
+      if(ip->ext[i].len > 0)
+        break;
+      ip->ext[i].addr = 0;
+    }
   }
+  for(i = 0; i < NEXTENT; i++)
+    nblk += ip->ext[i].len;
 
-  ip->size = 0;
+  if(ip->size > nblk * BSIZE)
+    ip->size = nblk * BSIZE;
   iupdate(ip);
+  return ip->dindirect == 0 && nblk == 0;
+}
+
+// Truncate ip to length zero, one transaction per
+// itruncstep().  Caller holds a reference to ip, but not its
+// lock, and is not in a transaction.
+void
+itruncate(struct inode *ip)
+{
+  int done;
+
+  do {
+    begin_op();
+    ilock(ip);
+    done = itruncstep(ip);
+    iunlock(ip);
+    end_op();
+  } while(!done);
 }
 
 // Copy stat information from inode.
@@ -448,6 +735,56 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Map file blocks bn..last of ip to disk blocks, stopping at the
+// first block that does not follow its predecessor on disk or
+// after MAXRUN blocks.  Sets *start to the disk block of bn and
+// returns the number of blocks in the run, or 0 if bn could not
+// be mapped.
+static int
+bmaprun(struct inode *ip, uint bn, uint last, uint *start)
+{
+  int n;
+
+  if((*start = bmap(ip, bn, last - bn + 1)) == 0)
+    return 0;
+  for(n = 1; n < MAXRUN && bn + n <= last; n++)
+    if(bmap(ip, bn + n, last - bn - n + 1) != *start + n)
+      break;
+  return n;
+}
+
+// Sequential readahead for a read of file blocks bn..last.
+// If the read continues where the previous one on ip left off,
+// grow ip's window (doubling, up to RA_MAX blocks) and start
+// reading the window beyond last into the buffer cache; any
+// other access pattern closes the window.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint bn, uint last)
+{
+  uint b, end, start;
+  int nb;
+
+  if(bn == ip->ra_next){
+    ip->ra_win = ip->ra_win ? min(2*ip->ra_win, RA_MAX) : RA_MIN;
+  } else if(bn + 1 != ip->ra_next){
+    // not sequential (a re-read of the last block is).
+    ip->ra_win = 0;
+    ip->ra_end = 0;
+  }
+  ip->ra_next = last + 1;
+  if(ip->ra_win == 0)
+    return;
+
+  end = min(last + 1 + ip->ra_win, (ip->size + BSIZE - 1) / BSIZE);
+  for(b = max(ip->ra_end, last + 1); b < end; b += nb){
+    if((nb = bmaprun(ip, b, end - 1, &start)) == 0)
+      break;
+    bprefetch(ip->dev, start, nb);
+  }
+  ip->ra_end = max(ip->ra_end, end);
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -455,23 +792,38 @@ stati(struct inode *ip, struct stat *st)
 int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
-  uint tot, m;
-  struct buf *bp;
+  uint tot, m, start;
+  int i, nb;
+  struct buf *bufs[MAXRUN];
 
   if(off > ip->size || off + n < off)
     return 0;
   if(off + n > ip->size)
     n = ip->size - off;
 
-  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
-      brelse(bp);
-      tot = -1;
+  if(n > 0)
+    readahead(ip, off/BSIZE, (off + n - 1)/BSIZE);
+
+  for(tot=0; tot<n; ){
+    // read as many physically adjacent blocks as we can at once.
+    nb = bmaprun(ip, off/BSIZE, (off + (n - tot) - 1)/BSIZE, &start);
+    if(nb == 0)
       break;
+    breadv(ip->dev, start, nb, bufs);
+    for(i = 0; i < nb; i++){
+      m = min(n - tot, BSIZE - off%BSIZE);
+      if(either_copyout(user_dst, dst, bufs[i]->data + (off % BSIZE), m) == -1) {
+        tot = -1;
+        break;
+      }
+      tot += m;
+      off += m;
+      dst += m;
     }
-    brelse(bp);
+    for(i = 0; i < nb; i++)
+      brelse(bufs[i]);
+    if(tot == -1)
+      break;
   }
   return tot;
 }
@@ -486,23 +838,38 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 int
 writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
-  uint tot, m;
-  struct buf *bp;
+  uint tot, m, start;
+  int i, nb, err;
+  struct buf *bufs[MAXRUN];
 
   if(off > ip->size || off + n < off)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
-  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
-      brelse(bp);
-      break;
+  err = 0;
+  for(tot=0; tot<n && !err; ){
+    // map (allocating as needed) a run of adjacent blocks
+    // before locking any of them, then read them all at once.
+    nb = bmaprun(ip, off/BSIZE, (off + (n - tot) - 1)/BSIZE, &start);
+    if(nb == 0)
+      break;  // out of disk blocks
+    breadv(ip->dev, start, nb, bufs);
+    for(i = 0; i < nb; i++){
+      if(!err){
+        m = min(n - tot, BSIZE - off%BSIZE);
+        if(either_copyin(bufs[i]->data + (off % BSIZE), user_src, src, m) == -1) {
+          err = 1;
+        } else {
+          log_write(bufs[i]);
+          pcache_write(ip, off, (char*)bufs[i]->data + (off % BSIZE), m);
+          tot += m;
+          off += m;
+          src += m;
+        }
+      }
+      brelse(bufs[i]);
     }
-    log_write(bp);
-    brelse(bp);
   }
 
   if(off > ip->size)
@@ -510,13 +877,19 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 
   // write the i-node back to disk even if the size didn't change
   // because the loop above might have called bmap() and added a new
-  // block to ip->addrs[].
+  // block to ip->ext[].
   iupdate(ip);
 
   return tot;
 }
 
 // Directories
+//
+// See fs.h for the layout of hashed directories.  Blocks of a
+// directory are named by their block number within it, and the
+// directory only grows, a block at a time.  Callers hold dp->lock,
+// so dirlookup() and dirlink() may hold several of dp's blocks at
+// once.
 
 int
 namecmp(const char *s, const char *t)
@@ -524,41 +897,267 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Hash of a directory entry name (FNV-1a).
+// mkfs uses the same hash.
+static uint
+dirhash(char *name)
+{
+  uint h = 2166136261;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+// Entry i of the index starting with chunk c.
+#define DXENT(c, i) (&(c)[(i) / DXPERCHUNK].e[(i) % DXPERCHUNK])
+
+// The index in directory block fbn, which is the root block
+// or an index block.
+static struct dxchunk*
+dxindex(struct buf *bp, int fbn)
+{
+  return (struct dxchunk*)(bp->data + (fbn == 0 ? 2*sizeof(struct dirent) : 0));
+}
+
+// The entry of index c that covers hash h.
+static int
+dxfind(struct dxchunk *c, uint h)
+{
+  int lo = 0, hi = c[0].count - 1;
+
+  while(lo < hi){
+    int mid = (lo + hi + 1) / 2;
+    if(DXENT(c, mid)->hash <= h)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return lo;
+}
+
+// Insert (hash, block) into index c after entry i.
+static void
+dxinsert(struct dxchunk *c, int i, uint hash, uint block)
+{
+  for(int j = c[0].count; j > i + 1; j--)
+    *DXENT(c, j) = *DXENT(c, j - 1);
+  DXENT(c, i + 1)->hash = hash;
+  DXENT(c, i + 1)->block = block;
+  c[0].count++;
+}
+
+// Read block fbn of directory dp.
+static struct buf*
+dirread(struct inode *dp, int fbn)
+{
+  uint addr;
+
+  if((addr = bmap(dp, fbn, 1)) == 0)
+    panic("dirread");
+  return bread(dp->dev, addr);
+}
+
+// Add a zeroed block to the end of directory dp.
+// Returns its block number, or -1 if the disk is full.
+static int
+dirgrow(struct inode *dp)
+{
+  uint fbn = dp->size / BSIZE;
+
+  if(fbn >= MAXFILE || bmap(dp, fbn, 1) == 0)
+    return -1;
+  dp->size += BSIZE;
+  iupdate(dp);
+  return fbn;
+}
+
+// Follow dp's index to the leaf for hash h.  Returns the leaf's
+// block, or -1 if dp has no leaves yet.  Sets *parent to the
+// root or index block with the leaf's entry and *pi to the
+// entry's position in it.
+static int
+dxwalk(struct inode *dp, uint h, int *parent, int *pi)
+{
+  struct buf *bp;
+  struct dxchunk *c;
+  int depth, fbn;
+
+  bp = dirread(dp, 0);
+  c = dxindex(bp, 0);
+  if(c[0].count == 0){
+    brelse(bp);
+    return -1;
+  }
+  depth = c[0].depth;
+  fbn = 0;
+  for(;;){
+    *parent = fbn;
+    *pi = dxfind(c, h);
+    fbn = DXENT(c, *pi)->block;
+    brelse(bp);
+    if(--depth == 0)
+      return fbn;
+    bp = dirread(dp, fbn);
+    c = dxindex(bp, fbn);
+  }
+}
+
+// Make the first block of the new directory dp, with entries
+// for itself and its parent.  Returns -1 if the disk is full.
+int
+dirinit(struct inode *dp, uint parent)
+{
+  struct buf *bp;
+  struct dirent *de;
+
+  if(dirgrow(dp) != 0)
+    return -1;
+  bp = dirread(dp, 0);
+  de = (struct dirent*)bp->data;
+  de[0].inum = dp->inum;
+  strncpy(de[0].name, ".", DIRSIZ);
+  de[1].inum = parent;
+  strncpy(de[1].name, "..", DIRSIZ);
+  dxindex(bp, 0)[0].depth = 1;
+  log_write(bp);
+  brelse(bp);
+  return 0;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// Caller must hold dp->lock.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
   uint off, inum;
-  struct dirent de;
+  int leaf, parent, pi, i;
+  struct buf *bp;
+  struct dirent *de;
+  struct inode *ip;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+  if(poff == 0 && dcache_lookup(dp, name, &ip))
+    return ip;
+
+  off = inum = 0;
+  if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0){
+    off = name[1] ? sizeof(struct dirent) : 0;
+    bp = dirread(dp, 0);
+    inum = ((struct dirent*)bp->data)[off / sizeof(struct dirent)].inum;
+    brelse(bp);
+  } else if((leaf = dxwalk(dp, dirhash(name), &parent, &pi)) >= 0){
+    bp = dirread(dp, leaf);
+    de = (struct dirent*)bp->data;
+    for(i = 0; i < DPB; i++){
+      if(de[i].inum && namecmp(name, de[i].name) == 0){
+        // entry matches path element
+        off = leaf*BSIZE + i*sizeof(struct dirent);
+        inum = de[i].inum;
+        break;
+      }
     }
+    brelse(bp);
+  }
+
+  dcache_enter(dp, name, inum);
+  if(inum == 0)
+    return 0;
+  if(poff)
+    *poff = off;
+  return iget(dp->dev, inum);
+}
+
+// Make room for one more entry in the index block parent, which
+// holds a leaf's entry at position *pi, by adding a level to the
+// index if it is the full root, or by splitting it if it is a
+// full index block.  *parent and *pi follow the entry if it moves.
+// Returns -1 if the directory or the disk is full.
+static int
+dxroom(struct inode *dp, int *parent, int *pi)
+{
+  struct buf *bp, *nbp, *rbp;
+  struct dxchunk *c, *nc, *rc;
+  int n, half, nfbn, i;
+
+  bp = dirread(dp, *parent);
+  n = dxindex(bp, *parent)[0].count;
+  brelse(bp);
+  if(n < (*parent == 0 ? DXROOT : DXNODE))
+    return 0;
+
+  if(*parent == 0){
+    // move the root's entries to a new index block.
+    if((nfbn = dirgrow(dp)) < 0)
+      return -1;
+    bp = dirread(dp, 0);
+    nbp = dirread(dp, nfbn);
+    c = dxindex(bp, 0);
+    nc = dxindex(nbp, nfbn);
+    for(i = 0; i < n; i++)
+      *DXENT(nc, i) = *DXENT(c, i);
+    nc[0].count = n;
+    c[0].count = 1;
+    c[0].depth = 2;
+    DXENT(c, 0)->hash = 0;
+    DXENT(c, 0)->block = nfbn;
+    log_write(nbp);
+    log_write(bp);
+    brelse(nbp);
+    brelse(bp);
+    *parent = nfbn;
+    return 0;
   }
 
+  // split the index block; the root needs room for the new half.
+  rbp = dirread(dp, 0);
+  n = dxindex(rbp, 0)[0].count;
+  brelse(rbp);
+  if(n >= DXROOT || (nfbn = dirgrow(dp)) < 0)
+    return -1;
+  rbp = dirread(dp, 0);
+  bp = dirread(dp, *parent);
+  nbp = dirread(dp, nfbn);
+  rc = dxindex(rbp, 0);
+  c = dxindex(bp, *parent);
+  nc = dxindex(nbp, nfbn);
+  n = c[0].count;
+  half = n / 2;
+  for(i = half; i < n; i++)
+    *DXENT(nc, i - half) = *DXENT(c, i);
+  nc[0].count = n - half;
+  c[0].count = half;
+  for(i = 0; DXENT(rc, i)->block != *parent; i++)
+    ;
+  dxinsert(rc, i, DXENT(nc, 0)->hash, nfbn);
+  log_write(nbp);
+  log_write(bp);
+  log_write(rbp);
+  brelse(nbp);
+  brelse(bp);
+  brelse(rbp);
+  if(*pi >= half){
+    *parent = nfbn;
+    *pi -= half;
+  }
   return 0;
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
+// Returns -1 if name is present, or if dp or the disk is full.
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-  int off;
-  struct dirent de;
   struct inode *ip;
+  struct buf *bp, *nbp;
+  struct dirent *de, *nde;
+  uint h, s, hs[DPB];
+  int leaf, nleaf, parent, pi, i, j;
 
   // Check that name is not present.
   if((ip = dirlookup(dp, name, 0)) != 0){
@@ -566,22 +1165,93 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  h = dirhash(name);
+  if((leaf = dxwalk(dp, h, &parent, &pi)) < 0){
+    // dp's first leaf.
+    if((leaf = dirgrow(dp)) < 0)
+      return -1;
+    bp = dirread(dp, 0);
+    dxindex(bp, 0)[0].count = 1;
+    DXENT(dxindex(bp, 0), 0)->block = leaf;
+    log_write(bp);
+    brelse(bp);
+    parent = pi = 0;
+  }
+
+  // Look for an empty dirent in the leaf.
+  bp = dirread(dp, leaf);
+  de = (struct dirent*)bp->data;
+  for(i = 0; i < DPB; i++){
+    if(de[i].inum == 0){
+      de[i].inum = inum;
+      strncpy(de[i].name, name, DIRSIZ);
+      log_write(bp);
+      brelse(bp);
+      dcache_enter(dp, name, inum);
+      return 0;
+    }
+    hs[i] = dirhash(de[i].name);
   }
+  brelse(bp);
 
-  strncpy(de.name, name, DIRSIZ);
-  de.inum = inum;
-  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-    panic("dirlink");
+  // The leaf is full.  Split it at the hash s of one of its
+  // names near the median, but above the smallest, so that
+  // neither half is empty and names with one hash stay together.
+  for(i = 1; i < DPB; i++){
+    s = hs[i];
+    for(j = i; j > 0 && hs[j-1] > s; j--)
+      hs[j] = hs[j-1];
+    hs[j] = s;
+  }
+  for(i = DPB/2; i < DPB && hs[i] == hs[0]; i++)
+    ;
+  if(i == DPB)
+    return -1;
+  s = hs[i];
 
+  if(dxroom(dp, &parent, &pi) < 0 || (nleaf = dirgrow(dp)) < 0)
+    return -1;
+
+  bp = dirread(dp, leaf);
+  nbp = dirread(dp, nleaf);
+  de = (struct dirent*)bp->data;
+  nde = (struct dirent*)nbp->data;
+  for(i = j = 0; i < DPB; i++){
+    if(dirhash(de[i].name) >= s){
+      nde[j++] = de[i];
+      memset(&de[i], 0, sizeof(de[i]));
+    }
+  }
+  if(h >= s)
+    de = nde;
+  for(i = 0; de[i].inum; i++)
+    ;
+  de[i].inum = inum;
+  strncpy(de[i].name, name, DIRSIZ);
+  log_write(nbp);
+  log_write(bp);
+  brelse(nbp);
+  brelse(bp);
+
+  bp = dirread(dp, parent);
+  dxinsert(dxindex(bp, parent), pi, s, nleaf);
+  log_write(bp);
+  brelse(bp);
+
+  dcache_enter(dp, name, inum);
   return 0;
 }
 
+// Log blocks that dirlink() may dirty: the root block, two index
+// blocks and two leaves, the doubly-indirect and indirect blocks
+// that may map the two blocks it adds, bitmap blocks for all the
+// new blocks, and the directory's i-node.
+int
+dirlinkcost(void)
+{
+  return 5 + 3 + 5 + 1;
+}
+
 // Paths
 
 // Copy the next path element from path into name.
@@ -636,6 +1306,15 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
+    // ip has cached names only if it is a directory, so a
+    // cached element needs neither ip's lock nor a scan.
+    if(!(nameiparent && *path == '\0') && dcache_lookup(ip, name, &next)){
+      iput(ip);
+      if(next == 0)
+        return 0;
+      ip = next;
+      continue;
+    }
     ilock(ip);
     if(ip->type != T_DIR){
       iunlockput(ip);
@@ -24,9 +24,21 @@ struct superblock {
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+// Most data blocks a log can hold: the log header block
+// holds a count and one block number per log block.
+#define MAXLOGSIZE (BSIZE / sizeof(uint) - 2)
+
+// A file's blocks are described by up to NEXTENT extents, runs of
+// consecutive disk blocks holding consecutive file blocks, in file
+// order.  Blocks past the extents hang off a doubly-indirect block.
+#define NEXTENT 6
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define MAXFILE (NINDIRECT * NINDIRECT)
+
+struct extent {
+  uint addr;            // first disk block
+  uint len;             // number of blocks; 0 if unused
+};
 
 // On-disk inode structure
 struct dinode {
@@ -35,7 +47,8 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  struct extent ext[NEXTENT]; // Data block extents
+  uint dindirect;       // Doubly-indirect block, for blocks past the extents
 };
 
 // Inodes per block.
@@ -51,10 +64,41 @@ struct dinode {
 #define BBLOCK(b, sb) ((b)/BPB + sb.bmapstart)
 
 // Directory is a file containing a sequence of dirent structures.
-#define DIRSIZ 14
+#define DIRSIZ 62
 
 struct dirent {
   ushort inum;
   char name[DIRSIZ];
 };
 
+// Directories are hashed.  Block 0 holds the "." and ".."
+// entries, followed by the root of an index that maps name
+// hashes to leaf blocks, which hold the other entries.  The
+// root points at the leaves, or in a big directory (depth 2)
+// at index blocks that point at the leaves.  An index is an
+// array of dxentry sorted by hash; an entry covers the hashes
+// from its own up to the next entry's, and the first entry's
+// hash is 0.  All the names with one hash are in one leaf.
+//
+// Index data is kept in dirent-sized chunks, each starting
+// with a zero inum, so that a program reading a directory as
+// an array of dirents skips it.
+struct dxentry {
+  uint hash;
+  uint block;         // block number within the directory
+};
+
+#define DXPERCHUNK 7
+
+struct dxchunk {
+  ushort inum;        // always 0
+  ushort count;       // entries in the index (first chunk only)
+  uchar depth;        // levels of index (root's first chunk only)
+  uchar pad[3];
+  struct dxentry e[DXPERCHUNK];
+};
+
+#define DPB      (BSIZE / sizeof(struct dirent))  // dirents per leaf
+#define DXROOT   ((DPB - 2) * DXPERCHUNK)          // entries in the root
+#define DXNODE   (DPB * DXPERCHUNK)                // entries in an index block
+
@@ -1,6 +1,23 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// Each CPU keeps its own free list so that the common
+// kalloc()/kfree() path takes only a per-CPU lock.
+// A CPU whose list runs dry refills a batch of KBATCH pages
+// from the global pool (or, if that is empty, steals half of
+// another CPU's list); a CPU whose list grows past KCPUMAX
+// hands a batch back to the global pool.
+//
+// Each page has a reference count, so that a page can be
+// mapped by several page tables and the page cache at once:
+// kalloc() returns a page with one reference, kdup() adds one,
+// and kfree() drops one and frees the page when none are left.
+//
+// By default freed pages are filled with junk to catch dangling
+// references.  A KPERF build (make KPERF=1) only poisons one page
+// in KPOISON_SAMPLE and checks that the poison is intact when the
+// page is handed out again.
 
 #include "types.h"
 #include "param.h"
@@ -9,6 +26,16 @@
 #include "riscv.h"
 #include "defs.h"
 
+#define KBATCH  32         // pages moved per refill or return
+#define KCPUMAX (4*KBATCH) // per-CPU high-water mark
+
+#ifdef KPERF
+#define KPOISON_SAMPLE 64
+#define POISONED(pa) ((((uint64)(pa)) >> PGSHIFT) % KPOISON_SAMPLE == 0)
+#else
+#define POISONED(pa) 1
+#endif
+
 void freerange(void *pa_start, void *pa_end);
 
 extern char end[]; // first address after kernel.
@@ -18,25 +45,103 @@ struct run {
   struct run *next;
 };
 
+// the global pool.
 struct {
   struct spinlock lock;
   struct run *freelist;
+  int nfree;
 } kmem;
 
+// page reference counts, indexed by physical page number.
+static int pageref[(PHYSTOP - KERNBASE) / PGSIZE];
+
+#define PAGEREF(pa) pageref[((uint64)(pa) - KERNBASE) / PGSIZE]
+
+// per-CPU free lists.
+// the lock is only contended when another CPU steals.
+struct {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;
+} kcpu[NCPU];
+
 void
 kinit()
 {
   initlock(&kmem.lock, "kmem");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kcpu[i].lock, "kmem_cpu");
   freerange(end, (void*)PHYSTOP);
 }
 
+// Hand every page in [pa_start, pa_end) to the global pool.
 void
 freerange(void *pa_start, void *pa_end)
 {
   char *p;
+  struct run *r;
+
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    if(POISONED(p))
+      memset(p, 1, PGSIZE);
+    r = (struct run*)p;
+    acquire(&kmem.lock);
+    r->next = kmem.freelist;
+    kmem.freelist = r;
+    kmem.nfree++;
+    release(&kmem.lock);
+  }
+}
+
+// Detach up to n pages from the front of *list.
+// Returns the detached chain and stores its length in *got.
+static struct run*
+takepages(struct run **list, int *nfree, int n, int *got)
+{
+  struct run *head, *r;
+  int i;
+
+  head = *list;
+  if(head == 0){
+    *got = 0;
+    return 0;
+  }
+  r = head;
+  for(i = 1; i < n && r->next; i++)
+    r = r->next;
+  *list = r->next;
+  r->next = 0;
+  *nfree -= i;
+  *got = i;
+  return head;
+}
+
+// Find a batch of free pages for CPU id, whose own list is empty.
+// Tries the global pool first, then steals from the other CPUs.
+// Called without any kmem lock held, so that stealing never
+// holds two CPU locks at once.
+static struct run*
+refill(int id, int *got)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  r = takepages(&kmem.freelist, &kmem.nfree, KBATCH, got);
+  release(&kmem.lock);
+  if(r)
+    return r;
+
+  for(int i = 1; i < NCPU; i++){
+    int victim = (id + i) % NCPU;
+    acquire(&kcpu[victim].lock);
+    int n = (kcpu[victim].nfree + 1) / 2;
+    r = takepages(&kcpu[victim].freelist, &kcpu[victim].nfree, n, got);
+    release(&kcpu[victim].lock);
+    if(r)
+      return r;
+  }
+  return 0;
 }
 
 // Free the page of physical memory pointed at by v,
@@ -46,37 +151,186 @@ freerange(void *pa_start, void *pa_end)
 void
 kfree(void *pa)
 {
-  struct run *r;
+  struct run *r, *batch;
+  int id, n;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  if((n = __sync_sub_and_fetch(&PAGEREF(pa), 1)) > 0)
+    return;
+  if(n < 0)
+    panic("kfree: free page");
+
   // Fill with junk to catch dangling refs.
-  memset(pa, 1, PGSIZE);
+  if(POISONED(pa))
+    memset(pa, 1, PGSIZE);
 
   r = (struct run*)pa;
+  batch = 0;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  id = cpuid();
+  acquire(&kcpu[id].lock);
+  r->next = kcpu[id].freelist;
+  kcpu[id].freelist = r;
+  kcpu[id].nfree++;
+  if(kcpu[id].nfree > KCPUMAX)
+    batch = takepages(&kcpu[id].freelist, &kcpu[id].nfree, KBATCH, &n);
+  release(&kcpu[id].lock);
+  pop_off();
+
+  if(batch){
+    // return a batch to the global pool.
+    for(r = batch; r->next; r = r->next)
+      ;
+    acquire(&kmem.lock);
+    r->next = kmem.freelist;
+    kmem.freelist = batch;
+    kmem.nfree += n;
+    release(&kmem.lock);
+  }
+}
+
+#ifdef KPERF
+// Check that a sampled page was not written after kfree().
+// The first bytes hold the free-list link.
+static void
+checkpoison(char *pa)
+{
+  for(int i = sizeof(struct run); i < PGSIZE; i++){
+    if(pa[i] != 1){
+      printf("kalloc: page %p modified after free at offset %d\n", pa, i);
+      panic("kalloc: poison");
+    }
+  }
+}
+#endif
+
+// Take one page off the free lists, without initializing it.
+static void *
+allocpage(void)
+{
+  struct run *r, *batch;
+  int id, n;
+
+  push_off();
+  id = cpuid();
+
+  acquire(&kcpu[id].lock);
+  r = kcpu[id].freelist;
+  if(r){
+    kcpu[id].freelist = r->next;
+    kcpu[id].nfree--;
+  }
+  release(&kcpu[id].lock);
+
+  if(r == 0 && (batch = refill(id, &n)) != 0){
+    // keep the first page, stash the rest.
+    r = batch;
+    if(n > 1){
+      struct run *last;
+      for(last = r->next; last->next; last = last->next)
+        ;
+      acquire(&kcpu[id].lock);
+      last->next = kcpu[id].freelist;
+      kcpu[id].freelist = r->next;
+      kcpu[id].nfree += n - 1;
+      release(&kcpu[id].lock);
+    }
+  }
+  pop_off();
+
+#ifdef KPERF
+  if(r && POISONED(r))
+    checkpoison((char*)r);
+#endif
+  if(r)
+    PAGEREF(r) = 1;
+  return (void*)r;
 }
 
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
+// The contents are undefined; use kzalloc() for a zeroed page.
 void *
 kalloc(void)
 {
-  struct run *r;
+  char *pa = allocpage();
+
+#ifndef KPERF
+  if(pa)
+    memset(pa, 5, PGSIZE); // fill with junk
+#endif
+  return (void*)pa;
+}
 
+// Add a reference to page pa, which kalloc() returned.
+void
+kdup(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kdup");
+  __sync_fetch_and_add(&PAGEREF(pa), 1);
+}
+
+// The number of references to page pa.
+int
+krefcnt(void *pa)
+{
+  return PAGEREF(pa);
+}
+
+// Allocate n physically contiguous, zeroed pages, for device
+// rings that the hardware reads by physical address.  Looks for
+// a run of adjacent pages in the global pool, which is likely
+// only early in boot.  Returns the lowest page, or 0 if there is
+// no such run.  Free each page with kfree().
+void *
+kallocn(int n)
+{
+  struct run **pp, **start, *r, *prev;
+  int len;
+
+  if(n <= 0)
+    return 0;
   acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
+  start = 0;
+  prev = 0;
+  len = 0;
+  // freerange() pushed pages in increasing order, so a run of
+  // adjacent pages appears in decreasing order.
+  for(pp = &kmem.freelist; (r = *pp) != 0; pp = &r->next){
+    if(len > 0 && (char*)r + PGSIZE == (char*)prev){
+      len++;
+    } else {
+      start = pp;
+      len = 1;
+    }
+    prev = r;
+    if(len == n){
+      *start = r->next;
+      kmem.nfree -= n;
+      release(&kmem.lock);
+      for(int i = 0; i < n; i++)
+        PAGEREF((char*)r + i*PGSIZE) = 1;
+      memset(r, 0, n*PGSIZE);
+      return (void*)r;
+    }
+  }
   release(&kmem.lock);
+  return 0;
+}
 
-  if(r)
-    memset((char*)r, 5, PGSIZE); // fill with junk
-  return (void*)r;
+// Allocate one zeroed 4096-byte page of physical memory.
+// Returns 0 if the memory cannot be allocated.
+void *
+kzalloc(void)
+{
+  char *pa = allocpage();
+
+  if(pa)
+    memset(pa, 0, PGSIZE);
+  return (void*)pa;
 }
@@ -4,6 +4,7 @@
 #include "param.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "proc.h"
 #include "fs.h"
 #include "buf.h"
 
@@ -16,10 +17,12 @@
 // write an uncommitted system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
+// its start and end, or begin_opn(n) if it knows it will
+// write at most n blocks. Usually begin_op() just reserves
+// the space in the log and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// sleeps until the transaction has been handed to the
+// committer.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -28,75 +31,141 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+//
+// Commits are done by a kernel thread, so end_op() does not
+// wait for the disk.  Once the last outstanding operation of a
+// transaction ends, the committer copies the transaction's
+// blocks out of the buffer cache into private log buffers, and
+// at that point a new transaction may start.  It then writes
+// the copies to the log, writes the header (the commit point),
+// installs the copies at their home locations and erases the
+// header, while the next transaction runs.  Log block and
+// install writes are each submitted as one batch.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
-  int block[LOGSIZE];
+  int block[MAXLOGSIZE];
 };
 
 struct log {
   struct spinlock lock;
   int start;
-  int size;
+  int size;        // log blocks on disk, including the header
+  int cap;         // most blocks one transaction may log
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // log blocks reserved by them.
+  int committing;  // committer is copying the transaction, please wait.
   int dev;
-  struct logheader lh;
+  struct logheader lh;  // the open transaction
+
+  // owned by the committer (or by recovery, before it starts).
+  struct logheader clh;      // the transaction being committed
+  struct buf *dbuf[MAXLOGSIZE]; // cache bufs of clh's blocks, pinned
+  struct buf *lbuf[MAXLOGSIZE]; // private copies of clh's blocks
 };
 struct log log;
 
 static void recover_from_log(void);
-static void commit();
+static void committer(void);
 
 void
 initlog(int dev, struct superblock *sb)
 {
+  char *page = 0;
+  int left = 0;
+
   if (sizeof(struct logheader) >= BSIZE)
     panic("initlog: too big logheader");
 
   initlock(&log.lock, "log");
   log.start = sb->logstart;
   log.size = sb->nlog;
+  log.cap = log.size - 1;
   log.dev = dev;
+  if (log.cap > MAXLOGSIZE || log.cap < MAXOPBLOCKS)
+    panic("initlog: bad log size");
+
+  // the private log buffers live outside the buffer cache.
+  for (int i = 0; i < log.cap; i++) {
+    if(left == 0){
+      if((page = kalloc()) == 0)
+        panic("initlog");
+      left = PGSIZE / sizeof(struct buf);
+    }
+    log.lbuf[i] = (struct buf*)page;
+    page += sizeof(struct buf);
+    left--;
+    memset(log.lbuf[i], 0, sizeof(struct buf));
+    initsleeplock(&log.lbuf[i]->lock, "logbuf");
+    log.lbuf[i]->dev = dev;
+  }
+
   recover_from_log();
+  kthread("logcommit", committer);
+}
+
+// Lock or unlock the private log buffers, which bwritev() insists
+// on, for the process about to use them.
+static void
+lockbufs(int lock)
+{
+  for (int i = 0; i < log.cap; i++) {
+    if(lock)
+      acquiresleep(&log.lbuf[i]->lock);
+    else
+      releasesleep(&log.lbuf[i]->lock);
+  }
 }
 
-// Copy committed blocks from log to their home location
+// Write the private copies of clh's blocks to the log.
 static void
-install_trans(int recovering)
+write_log(void)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+  for (tail = 0; tail < log.clh.n; tail++)
+    log.lbuf[tail]->blockno = log.start+tail+1;
+  bwritev(log.lbuf, log.clh.n);
+}
+
+// Write the private copies of clh's blocks to their home
+// locations, as one batch sorted by block number so that
+// adjacent blocks share a disk request.  The cache's copies
+// are not touched; they are as new or newer.
+static void
+install_trans(void)
+{
+  int i, j;
+  struct buf *b;
+
+  for (i = 0; i < log.clh.n; i++)
+    log.lbuf[i]->blockno = log.clh.block[i];
+  for (i = 1; i < log.clh.n; i++) {
+    b = log.lbuf[i];
+    for (j = i; j > 0 && log.lbuf[j-1]->blockno > b->blockno; j--)
+      log.lbuf[j] = log.lbuf[j-1];
+    log.lbuf[j] = b;
   }
+  bwritev(log.lbuf, log.clh.n);
 }
 
-// Read the log header from disk into the in-memory log header
+// Read the log header from disk into clh.
 static void
 read_head(void)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  log.clh.n = lh->n;
+  for (i = 0; i < log.clh.n; i++) {
+    log.clh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
+// Write clh to disk.
 // This is the true point at which the
 // current transaction commits.
 static void
@@ -105,9 +174,9 @@ write_head(void)
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = log.clh.n;
+  for (i = 0; i < log.clh.n; i++) {
+    hb->block[i] = log.clh.block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -117,94 +186,168 @@ static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
+  lockbufs(1);
+  for (int tail = 0; tail < log.clh.n; tail++) {
+    struct buf *b = bread(log.dev, log.start+tail+1);
+    memmove(log.lbuf[tail]->data, b->data, BSIZE);
+    brelse(b);
+  }
+  install_trans(); // if committed, copy from log to disk
+  lockbufs(0);
+  log.clh.n = 0;
   write_head(); // clear the log
 }
 
-// called at the start of each FS system call.
+// called at the start of each FS system call that writes at
+// most n blocks.  n must be an upper bound, since the op's blocks
+// have to fit in the log along with those of the other ops.
 void
-begin_op(void)
+begin_opn(int n)
 {
+  if(n > log.cap)
+    panic("begin_op: too big");
+
   acquire(&log.lock);
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + log.reserved + n > log.cap){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
+      myproc()->logres = n;
       release(&log.lock);
       break;
     }
   }
 }
 
+// called at the start of FS system calls without a
+// more precise estimate.
+void
+begin_op(void)
+{
+  begin_opn(MAXOPBLOCKS);
+}
+
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// hands the transaction to the committer if this was
+// the last outstanding operation, and then frees any
+// inodes the op unlinked for good.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
+  log.reserved -= myproc()->logres;
   if(log.committing)
     panic("log.committing");
   if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
+    wakeup(&log.lh);
   } else {
     // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
+    // and decrementing log.reserved has decreased
     // the amount of reserved space.
     wakeup(&log);
   }
   release(&log.lock);
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
-  }
+  // free the inodes that iput() left for after the op.
+  if(myproc()->ifree)
+    ireclaim();
+}
+
+// Log blocks that a writei() of n bytes may dirty: each data
+// block and the bitmap block it is allocated from, 2 more for
+// non-aligned writes, the i-node, and the doubly-indirect block
+// and up to two indirect blocks under it, with their bitmap
+// blocks.
+int
+log_writecost(int n)
+{
+  return 2 * ((n + BSIZE - 1) / BSIZE + 1) + 1 + 2*3;
+}
+
+// Largest write, in bytes, that filewrite() should put in one
+// transaction: small enough for about four writers to share
+// the log.
+int
+log_maxwrite(void)
+{
+  int nb = (log.cap / 4 - 4) / 2;
+
+  if(nb < (MAXOPBLOCKS - 4) / 2)
+    nb = (MAXOPBLOCKS - 4) / 2;
+  return nb * BSIZE;
 }
 
-// Copy modified blocks from cache to log.
+// Copy the modified blocks of the open transaction from the
+// cache into the private log buffers, and make it clh.
+// Called with log.committing set, so nothing can modify them.
 static void
-write_log(void)
+snapshot(void)
 {
   int tail;
 
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
     struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+    memmove(log.lbuf[tail]->data, from->data, BSIZE);
+    log.dbuf[tail] = from;  // stays pinned until installed
     brelse(from);
-    brelse(to);
+    log.clh.block[tail] = log.lh.block[tail];
   }
+  log.clh.n = log.lh.n;
 }
 
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
+  if (log.clh.n > 0) {
+    write_log();     // Write modified blocks from private bufs to log
     write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
+    install_trans(); // Now install writes to home locations
+    for (int i = 0; i < log.clh.n; i++)
+      bunpin(log.dbuf[i]);
+    log.clh.n = 0;
     write_head();    // Erase the transaction from the log
   }
 }
 
+// The committer kernel thread.  Waits for a transaction with
+// no operations in progress, takes it over, lets the next one
+// start, and commits it.
+static void
+committer(void)
+{
+  lockbufs(1);
+  acquire(&log.lock);
+  for(;;){
+    while(log.lh.n == 0 || log.outstanding > 0)
+      sleep(&log.lh, &log.lock);
+    log.committing = 1;
+    release(&log.lock);
+
+    snapshot();
+
+    acquire(&log.lock);
+    log.lh.n = 0;
+    log.committing = 0;
+    wakeup(&log);
+    release(&log.lock);
+
+    // call commit w/o holding locks, since not allowed
+    // to sleep with locks.
+    commit();
+
+    acquire(&log.lock);
+  }
+}
+
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
-// commit()/write_log() will do the disk write.
+// The committer will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -216,7 +359,7 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.cap)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -233,4 +376,3 @@ log_write(struct buf *b)
   }
   release(&log.lock);
 }
-
@@ -20,6 +20,7 @@ main()
     printf("xv6 kernel is booting\n");
     printf("\n");
     kinit();         // physical page allocator
+    slabinit();      // small object caches
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
@@ -29,13 +30,20 @@ main()
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode cache
+    dcacheinit();    // directory name cache
+    pcacheinit();    // file page cache
     fileinit();      // file table
+    pipeinit();      // pipe buffers
     virtio_disk_init(); // emulated hard disk
 #ifdef LAB_NET
+    mbufinit();      // packet buffer pool
     pci_init();
     sockinit();
 #endif    
     userinit();      // first user process
+#ifdef LAB_NET
+    e1000_pollinit(); // network receive thread
+#endif
 #ifdef KCSAN
     kcsaninit();
 #endif
@@ -61,21 +61,150 @@ mbuftrim(struct mbuf *m, unsigned int len)
   return m->head + m->len;
 }
 
+// Packet buffers are allocated from their own pool rather than
+// one kalloc() page each.  Two mbufs share a page; a page goes
+// back to kalloc() once both halves are free in the global pool.
+// Each CPU caches up to MBUF_PERCPU free mbufs, so the
+// allocation on the receive path usually takes no lock.
+// Buffers are not zeroed on allocation.
+
+#define MBUF_PERCPU 32  // free mbufs cached per CPU
+#define MBUF_BATCH  16  // mbufs moved between a CPU and the pool
+
+// marks an mbuf that sits on the global free list; a live
+// mbuf's len never exceeds MBUF_SIZE.
+#define MBUF_FREE   0xffffffff
+
+static struct {
+  struct spinlock lock;
+  struct mbuf *free;  // doubly linked through next and head
+  int nfree;
+  int npages;         // pages currently owned by the pool
+  int nfail;          // allocations that found no memory
+} mpool;
+
+static struct {
+  struct mbuf *cache[MBUF_PERCPU];
+  int n;
+  int nalloc;
+  int nfree;
+} mcpu[NCPU];
+
+#define MPREV(m) (*(struct mbuf **)&(m)->head)
+
+void
+mbufinit(void)
+{
+  initlock(&mpool.lock, "mbufpool");
+  if(sizeof(struct mbuf) != PGSIZE/2)
+    panic("mbufinit: sizeof(struct mbuf)");
+}
+
+// Return the other mbuf in m's page.
+static struct mbuf *
+mbufbuddy(struct mbuf *m)
+{
+  return (struct mbuf *)((uint64)m ^ (PGSIZE/2));
+}
+
+// Put m on the global free list, releasing its page if the
+// buddy is already there.  Caller holds mpool.lock.
+static void
+mpoolput(struct mbuf *m)
+{
+  struct mbuf *b = mbufbuddy(m);
+
+  if(b->len == MBUF_FREE){
+    if(MPREV(b))
+      MPREV(b)->next = b->next;
+    else
+      mpool.free = b->next;
+    if(b->next)
+      MPREV(b->next) = MPREV(b);
+    mpool.nfree--;
+    mpool.npages--;
+    kfree((void*)PGROUNDDOWN((uint64)m));
+    return;
+  }
+  m->len = MBUF_FREE;
+  MPREV(m) = 0;
+  m->next = mpool.free;
+  if(mpool.free)
+    MPREV(mpool.free) = m;
+  mpool.free = m;
+  mpool.nfree++;
+}
+
+// Take an mbuf off the global free list, or 0.
+// Caller holds mpool.lock.
+static struct mbuf *
+mpoolget(void)
+{
+  struct mbuf *m = mpool.free;
+
+  if(m){
+    mpool.free = m->next;
+    if(m->next)
+      MPREV(m->next) = 0;
+    mpool.nfree--;
+    m->len = 0;
+  }
+  return m;
+}
+
+// Refill this CPU's cache from the global pool, carving
+// a fresh page if the pool is empty.
+// Called with interrupts off.
+static void
+mbufrefill(void)
+{
+  struct mbuf *m;
+  char *pa;
+  int id = cpuid();
+
+  acquire(&mpool.lock);
+  while(mcpu[id].n < MBUF_BATCH && (m = mpoolget()) != 0)
+    mcpu[id].cache[mcpu[id].n++] = m;
+  if(mcpu[id].n == 0){
+    if((pa = kalloc()) != 0){
+      mpool.npages++;
+      for(m = (struct mbuf *)pa; (char *)m < pa + PGSIZE; m++){
+        m->len = 0;
+        mcpu[id].cache[mcpu[id].n++] = m;
+      }
+    } else {
+      mpool.nfail++;
+    }
+  }
+  release(&mpool.lock);
+}
+
 // Allocates a packet buffer.
 struct mbuf *
 mbufalloc(unsigned int headroom)
 {
   struct mbuf *m;
- 
+  int id;
+
   if (headroom > MBUF_SIZE)
     return 0;
-  m = kalloc();
+
+  push_off();
+  id = cpuid();
+  if(mcpu[id].n == 0)
+    mbufrefill();
+  m = 0;
+  if(mcpu[id].n > 0){
+    m = mcpu[id].cache[--mcpu[id].n];
+    mcpu[id].nalloc++;
+  }
+  pop_off();
+
   if (m == 0)
     return 0;
   m->next = 0;
   m->head = (char *)m->buf + headroom;
   m->len = 0;
-  memset(m->buf, 0, sizeof(m->buf));
   return m;
 }
 
@@ -83,7 +212,37 @@ mbufalloc(unsigned int headroom)
 void
 mbuffree(struct mbuf *m)
 {
-  kfree(m);
+  int id;
+
+  push_off();
+  id = cpuid();
+  mcpu[id].nfree++;
+  if(mcpu[id].n == MBUF_PERCPU){
+    // cache is full; hand a batch back to the pool.
+    acquire(&mpool.lock);
+    for(int i = 0; i < MBUF_BATCH; i++)
+      mpoolput(mcpu[id].cache[--mcpu[id].n]);
+    release(&mpool.lock);
+  }
+  m->len = 0;
+  mcpu[id].cache[mcpu[id].n++] = m;
+  pop_off();
+}
+
+// Print packet buffer counters.  For debugging.
+void
+mbufstats(void)
+{
+  int nalloc = 0, nfree = 0, ncached = 0;
+
+  for(int i = 0; i < NCPU; i++){
+    nalloc += mcpu[i].nalloc;
+    nfree += mcpu[i].nfree;
+    ncached += mcpu[i].n;
+  }
+  printf("mbuf: alloc %d free %d inuse %d cached %d pooled %d pages %d fail %d\n",
+         nalloc, nfree, nalloc - nfree, ncached, mpool.nfree,
+         mpool.npages, mpool.nfail);
 }
 
 // Pushes an mbuf to the end of the queue.
@@ -159,9 +318,11 @@ in_cksum(const unsigned char *addr, int len)
   return answer;
 }
 
-// sends an ethernet packet
-static void
-net_tx_eth(struct mbuf *m, uint16 ethtype)
+// sends an ethernet packet.  if the e1000's transmit ring is
+// full, waits for room if wait is set, and otherwise drops the
+// packet.  returns -1 if the packet was dropped.
+static int
+net_tx_eth(struct mbuf *m, uint16 ethtype, int wait)
 {
   struct eth *ethhdr;
 
@@ -172,14 +333,16 @@ net_tx_eth(struct mbuf *m, uint16 ethtype)
   // to broadcast instead.
   memmove(ethhdr->dhost, broadcast_mac, ETHADDR_LEN);
   ethhdr->type = htons(ethtype);
-  if (e1000_transmit(m)) {
+  if (e1000_transmit(m, wait)) {
     mbuffree(m);
+    return -1;
   }
+  return 0;
 }
 
 // sends an IP packet
-static void
-net_tx_ip(struct mbuf *m, uint8 proto, uint32 dip)
+static int
+net_tx_ip(struct mbuf *m, uint8 proto, uint32 dip, int wait)
 {
   struct ip *iphdr;
 
@@ -195,11 +358,13 @@ net_tx_ip(struct mbuf *m, uint8 proto, uint32 dip)
   iphdr->ip_sum = in_cksum((unsigned char *)iphdr, sizeof(*iphdr));
 
   // now on to the ethernet layer
-  net_tx_eth(m, ETHTYPE_IP);
+  return net_tx_eth(m, ETHTYPE_IP, wait);
 }
 
-// sends a UDP packet
-void
+// sends a UDP packet, waiting for room in the transmit ring.
+// called only by user processes, from sockwrite(), never by
+// the e1000poll kernel thread.
+int
 net_tx_udp(struct mbuf *m, uint32 dip,
            uint16 sport, uint16 dport)
 {
@@ -213,7 +378,7 @@ net_tx_udp(struct mbuf *m, uint32 dip,
   udphdr->sum = 0; // zero means no checksum is provided
 
   // now on to the IP layer
-  net_tx_ip(m, IPPROTO_UDP, dip);
+  return net_tx_ip(m, IPPROTO_UDP, dip, 1);
 }
 
 // sends an ARP packet
@@ -241,9 +406,12 @@ net_tx_arp(uint16 op, uint8 dmac[ETHADDR_LEN], uint32 dip)
   memmove(arphdr->tha, dmac, ETHADDR_LEN);
   arphdr->tip = htonl(dip);
 
-  // header is ready, send the packet
-  net_tx_eth(m, ETHTYPE_ARP);
-  return 0;
+  // header is ready, send the packet.  replies are sent by
+  // net_rx() in the e1000poll kernel thread, which is also the
+  // thread that reaps the transmit ring and wakes its waiters.
+  // it must not block on that ring, so a reply is dropped if the
+  // ring is full; the peer will ask again.
+  return net_tx_eth(m, ETHTYPE_ARP, 0);
 }
 
 // receives an ARP packet
@@ -351,8 +519,8 @@ fail:
   mbuffree(m);
 }
 
-// called by e1000 driver's interrupt handler to deliver a packet to the
-// networking stack
+// called by the e1000 driver's poll thread, e1000_poll(), to deliver
+// a packet to the networking stack
 void net_rx(struct mbuf *m)
 {
   struct eth *ethhdr;
@@ -2,7 +2,9 @@
 // packet buffer management
 //
 
-#define MBUF_SIZE              2048
+// sized so that a struct mbuf is exactly half a page; see mbufalloc().
+// still larger than the biggest ethernet frame the e1000 will deliver.
+#define MBUF_SIZE              2024
 #define MBUF_DEFAULT_HEADROOM  128
 
 struct mbuf {
@@ -1,13 +1,14 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
+#define NVMA         16  // memory mappings per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define MAXOPBLOCKS  10  // log blocks reserved by a plain begin_op()
+#define LOGSIZE     128  // blocks in the on-disk log made by mkfs
+#define NBUF         1024  // size of disk block cache
+#define MAXRUN        8  // max blocks in one disk request
 #define FSSIZE       1000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
@@ -0,0 +1,191 @@
+// File page cache.
+//
+// Holds whole pages of file contents, (dev, inum, page number)
+// -> physical page, for mmap().  A cached page can be mapped
+// straight into user page tables, so that reading a mapped file
+// costs one copy from the disk blocks into the page rather than
+// one per read() call.
+//
+// The cache holds one reference to each of its pages (see
+// kalloc.c); every page table that maps a page holds another.
+// Only a page that nobody maps can be evicted.
+//
+// The cache has to agree with the file:
+// * writei() passes every write to pcache_write(), which
+//   updates a cached copy of the page.
+// * itruncstep() calls pcache_drop() to forget a file's pages.
+// Both, and pcache_get(), are called with the inode locked.
+//
+// Interface:
+// * pcache_get(ip, pgno) returns page pgno of ip, with a
+//   reference for the caller.
+// * pcache_write(ip, off, src, n) updates cached pages.
+// * pcache_drop(ip) forgets ip's pages.
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+#define NPCACHE  512
+#define NPHASH   127
+
+struct cpage {
+  uint dev;
+  uint inum;         // 0 if the entry is unused
+  uint pgno;
+  char *pa;
+  uint lastuse;
+  struct cpage *next;  // hash chain
+};
+
+static struct {
+  struct spinlock lock;
+  struct cpage page[NPCACHE];
+  struct cpage *hash[NPHASH];
+  int hits, misses;
+} pcache;
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+static int
+phash(uint dev, uint inum, uint pgno)
+{
+  return (dev*31*31 + inum*31 + pgno) % NPHASH;
+}
+
+// Find the entry for page pgno of (dev, inum).
+// Caller holds pcache.lock.
+static struct cpage*
+pfind(uint dev, uint inum, uint pgno)
+{
+  struct cpage *c;
+
+  for(c = pcache.hash[phash(dev, inum, pgno)]; c; c = c->next){
+    if(c->inum == inum && c->pgno == pgno && c->dev == dev)
+      return c;
+  }
+  return 0;
+}
+
+// Take c off its hash chain and drop the cache's reference.
+// Caller holds pcache.lock.
+static void
+punhash(struct cpage *c)
+{
+  struct cpage **pp;
+
+  for(pp = &pcache.hash[phash(c->dev, c->inum, c->pgno)]; *pp; pp = &(*pp)->next){
+    if(*pp == c){
+      *pp = c->next;
+      break;
+    }
+  }
+  kfree(c->pa);
+  c->inum = 0;
+}
+
+// Return page pgno of ip, reading it if it is not cached, with
+// a reference that the caller must kfree().  Bytes past the end
+// of the file are zero.  Returns 0 if out of memory.
+// Caller holds ip->lock, so no one else can add ip's pages.
+char*
+pcache_get(struct inode *ip, uint pgno)
+{
+  struct cpage *c, *victim;
+  char *pa;
+  int h;
+
+  acquire(&pcache.lock);
+  if((c = pfind(ip->dev, ip->inum, pgno)) != 0){
+    pcache.hits++;
+    c->lastuse = ticks;
+    kdup(c->pa);
+    release(&pcache.lock);
+    return c->pa;
+  }
+  pcache.misses++;
+  release(&pcache.lock);
+
+  if((pa = kzalloc()) == 0)
+    return 0;
+  if((uint64)pgno*PGSIZE < ip->size &&
+     readi(ip, 0, (uint64)pa, pgno*PGSIZE, PGSIZE) < 0){
+    kfree(pa);
+    return 0;
+  }
+
+  // recycle an unused entry, or else the least recently used
+  // page that nobody maps.  if every page is mapped, the caller
+  // gets an uncached copy.
+  acquire(&pcache.lock);
+  victim = 0;
+  for(c = pcache.page; c < &pcache.page[NPCACHE]; c++){
+    if(c->inum == 0){
+      victim = c;
+      break;
+    }
+    if(krefcnt(c->pa) == 1 && (victim == 0 || c->lastuse < victim->lastuse))
+      victim = c;
+  }
+  if(victim){
+    c = victim;
+    if(c->inum)
+      punhash(c);
+    c->dev = ip->dev;
+    c->inum = ip->inum;
+    c->pgno = pgno;
+    c->pa = pa;
+    c->lastuse = ticks;
+    h = phash(c->dev, c->inum, c->pgno);
+    c->next = pcache.hash[h];
+    pcache.hash[h] = c;
+    kdup(pa);
+  }
+  release(&pcache.lock);
+  return pa;
+}
+
+// writei() has written n bytes from kernel address src at
+// offset off of ip, all within one page.  Copy them into the
+// cached page, if any, so that mappings see them.
+void
+pcache_write(struct inode *ip, uint off, char *src, uint n)
+{
+  struct cpage *c;
+
+  acquire(&pcache.lock);
+  if((c = pfind(ip->dev, ip->inum, off / PGSIZE)) != 0)
+    memmove(c->pa + off % PGSIZE, src, n);
+  release(&pcache.lock);
+}
+
+// Forget ip's pages, which are being truncated.  Pages that
+// are still mapped live on until they are unmapped.
+void
+pcache_drop(struct inode *ip)
+{
+  struct cpage *c;
+
+  acquire(&pcache.lock);
+  for(c = pcache.page; c < &pcache.page[NPCACHE]; c++){
+    if(c->inum == ip->inum && c->dev == ip->dev)
+      punhash(c);
+  }
+  release(&pcache.lock);
+}
+
+// Print hit counters.  For debugging.
+void
+pcachestats(void)
+{
+  printf("pcache: hits %d misses %d\n", pcache.hits, pcache.misses);
+}
@@ -16,6 +16,7 @@ int nextpid = 1;
 struct spinlock pid_lock;
 
 extern void forkret(void);
+static void kthreadstart(void);
 static void wakeup1(struct proc *chan);
 static void freeproc(struct proc *p);
 
@@ -156,6 +157,7 @@ freeproc(struct proc *p)
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->kfn = 0;
   p->state = UNUSED;
 }
 
@@ -240,21 +242,54 @@ userinit(void)
   release(&p->lock);
 }
 
+// Create a kernel thread that runs fn(), which must not return.
+// It has a process slot, so it can sleep and be woken like any
+// process, but it never runs in user space.
+void
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kthread");
+  p->context.ra = (uint64)kthreadstart;
+  p->kfn = fn;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->state = RUNNABLE;
+  release(&p->lock);
+}
+
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthreadstart.
+static void
+kthreadstart(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+  p->kfn();
+  panic("kthread returned");
+}
+
 // Grow or shrink user memory by n bytes.
+// Growing only raises p->sz: the new pages are allocated
+// when they are first touched (see vmfault()).
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
 {
-  uint sz;
+  uint64 sz;
   struct proc *p = myproc();
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
-      return -1;
-    }
+    if(sz + n > vmabase(p))
+      return -1;  // would run into mmap()ed files.
+    sz += n;
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
+    vmatrim(p, p->sz, sz);
   }
   p->sz = sz;
   return 0;
@@ -274,13 +309,16 @@ fork(void)
     return -1;
   }
 
-  // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  // Copy user memory from parent to child.  Set np->sz first,
+  // so that freeproc() unmaps what uvmcopy() mapped if vmafork()
+  // fails; uvmunmap() skips pages that aren't mapped.
+  np->sz = p->sz;
+  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0 ||
+     vmafork(p, np) < 0){
     freeproc(np);
     release(&np->lock);
     return -1;
   }
-  np->sz = p->sz;
 
   np->parent = p;
 
@@ -307,6 +345,52 @@ fork(void)
   return pid;
 }
 
+// Create a new process running the program path with arguments
+// argv, like fork() followed by exec() in the child, but without
+// copying the caller's memory.  The child's descriptor i is a
+// duplicate of the caller's fdmap[i] for i < nfd, and the rest
+// are closed; if fdmap is 0, the child inherits all of the
+// caller's descriptors.  Returns the child's pid, or -1.
+int
+spawn(char *path, char **argv, int *fdmap, int nfd)
+{
+  int i, argc, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if((np = allocproc()) == 0)
+    return -1;
+  // exec sleeps, so hold np with its state rather than its lock.
+  np->state = USED;
+  release(&np->lock);
+
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+  if((argc = execproc(np, path, argv)) < 0){
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  // argc is main()'s first argument.
+  np->trapframe->a0 = argc;
+
+  for(i = 0; i < NOFILE; i++){
+    if(fdmap == 0 && p->ofile[i])
+      np->ofile[i] = filedup(p->ofile[i]);
+    else if(fdmap && i < nfd && fdmap[i] >= 0)
+      np->ofile[i] = filedup(p->ofile[fdmap[i]]);
+  }
+  np->cwd = idup(p->cwd);
+
+  acquire(&np->lock);
+  np->parent = p;
+  pid = np->pid;
+  np->state = RUNNABLE;
+  release(&np->lock);
+
+  return pid;
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold p->lock.
 void
@@ -344,6 +428,9 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  // Unmap files, writing shared mappings back.
+  vmafree(p);
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -471,12 +558,9 @@ scheduler(void)
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
     
-    int nproc = 0;
+    int found = 0;
     for(p = proc; p < &proc[NPROC]; p++) {
       acquire(&p->lock);
-      if(p->state != UNUSED) {
-        nproc++;
-      }
       if(p->state == RUNNABLE) {
         // Switch to chosen process.  It is the process's job
         // to release its lock and then reacquire it
@@ -488,10 +572,11 @@ scheduler(void)
         // Process is done running for now.
         // It should have changed its p->state before coming back.
         c->proc = 0;
+        found = 1;
       }
       release(&p->lock);
     }
-    if(nproc <= 2) {   // only init and sh exist
+    if(found == 0) {   // nothing to run; wait for an interrupt
       intr_on();
       asm volatile("wfi");
     }
@@ -681,6 +766,7 @@ procdump(void)
 {
   static char *states[] = {
   [UNUSED]    "unused",
+  [USED]      "used  ",
   [SLEEPING]  "sleep ",
   [RUNNABLE]  "runble",
   [RUNNING]   "run   ",
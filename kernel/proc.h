@@ -80,7 +80,20 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
-enum procstate { UNUSED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
+// A memory-mapped region of a file, [start, end): an mmap()ed
+// file, or a segment of the running program.  Pages are faulted
+// in on first use; see vma.c.
+struct vma {
+  uint64 start;
+  uint64 end;
+  int prot;                    // PROT_* from fcntl.h
+  int flags;                   // MAP_SHARED or MAP_PRIVATE
+  struct inode *ip;            // mapped file, or 0 if unused
+  uint off;                    // file offset of start
+  uint64 filesz;               // bytes from the file; the rest is zero
+};
+
+enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
 struct proc {
@@ -102,5 +115,9 @@ struct proc {
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct vma vma[NVMA];        // Memory-mapped files
   char name[16];               // Process name (debugging)
+  void (*kfn)(void);           // Kernel thread body, if a kernel thread
+  int logres;                  // Log blocks reserved by begin_opn()
+  struct inode *ifree;         // Inodes for end_op() to free (see iput())
 };
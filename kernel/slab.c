@@ -0,0 +1,233 @@
+// Object caches for small kernel objects.
+//
+// A kmem_cache hands out fixed-size objects carved from
+// kalloc() pages ("slabs") instead of a whole page per object.
+// Each slab starts with a struct slab header followed by as
+// many objects as fit.  Slabs with free objects sit on the
+// cache's partial list; a slab goes back to kalloc() as soon
+// as its last object is freed.
+//
+// In front of the slabs, each CPU keeps a small magazine of
+// free objects, so most allocations and frees touch neither
+// the cache lock nor the page allocator.
+//
+// Interface:
+// * kmem_cache_create(name, size) at boot, once per object type.
+// * kmem_cache_alloc(c) returns an uninitialized object, or 0.
+// * kmem_cache_free(c, obj) returns it.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NKMCACHE  16   // max number of caches
+#define KMC_MAG   16   // objects in a per-CPU magazine
+
+struct slab {
+  struct slab *next;   // partial list
+  struct slab *prev;
+  struct kmem_cache *cache;
+  void *free;          // free objects, linked through their first word
+  int inuse;           // objects handed out (including magazines)
+};
+
+struct kmem_cache {
+  struct spinlock lock;
+  char *name;
+  uint size;           // object size, rounded up
+  int perslab;         // objects per slab
+  struct slab *partial; // slabs with at least one free object
+  int nslabs;
+
+  struct {
+    void *obj[KMC_MAG];
+    int n;
+  } mag[NCPU];
+};
+
+static struct {
+  struct spinlock lock;
+  struct kmem_cache cache[NKMCACHE];
+  int n;
+} kmc;
+
+// offset of the first object in a slab.
+#define SLABHDR ((sizeof(struct slab) + 15) & ~15)
+
+void
+slabinit(void)
+{
+  initlock(&kmc.lock, "kmc");
+}
+
+// Create a cache of objects of the given size.
+// Panics if the table is full or the object is too big
+// to share a page with a slab header.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size)
+{
+  struct kmem_cache *c;
+
+  size = (size + 15) & ~15;
+  if(size < sizeof(void*) || size > PGSIZE - SLABHDR)
+    panic("kmem_cache_create: size");
+
+  acquire(&kmc.lock);
+  if(kmc.n == NKMCACHE)
+    panic("kmem_cache_create: too many caches");
+  c = &kmc.cache[kmc.n++];
+  release(&kmc.lock);
+
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  c->perslab = (PGSIZE - SLABHDR) / size;
+  c->partial = 0;
+  c->nslabs = 0;
+  for(int i = 0; i < NCPU; i++)
+    c->mag[i].n = 0;
+  return c;
+}
+
+static void
+partial_remove(struct kmem_cache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+  s->next = s->prev = 0;
+}
+
+static void
+partial_insert(struct kmem_cache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(c->partial)
+    c->partial->prev = s;
+  c->partial = s;
+}
+
+// Carve a new slab from a fresh page.
+// Caller holds c->lock.
+static struct slab*
+slab_grow(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *p;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->inuse = 0;
+  s->free = 0;
+  for(int i = c->perslab - 1; i >= 0; i--){
+    p = (char*)s + SLABHDR + i*c->size;
+    *(void**)p = s->free;
+    s->free = p;
+  }
+  partial_insert(c, s);
+  c->nslabs++;
+  return s;
+}
+
+// Take one object from the slabs.
+// Caller holds c->lock.
+static void*
+slab_get(struct kmem_cache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  if((s = c->partial) == 0 && (s = slab_grow(c)) == 0)
+    return 0;
+  obj = s->free;
+  s->free = *(void**)obj;
+  s->inuse++;
+  if(s->free == 0)
+    partial_remove(c, s);  // now full
+  return obj;
+}
+
+// Return one object to its slab, freeing the slab if it is empty.
+// Caller holds c->lock.
+static void
+slab_put(struct kmem_cache *c, void *obj)
+{
+  struct slab *s = (struct slab*)PGROUNDDOWN((uint64)obj);
+
+  if(s->cache != c)
+    panic("kmem_cache_free: wrong cache");
+  if(s->free == 0)
+    partial_insert(c, s);  // was full
+  *(void**)obj = s->free;
+  s->free = obj;
+  if(--s->inuse == 0){
+    partial_remove(c, s);
+    c->nslabs--;
+    kfree((void*)s);
+  }
+}
+
+// Allocate an object from cache c.
+// Returns 0 if memory is exhausted.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  void *obj = 0;
+  int id;
+
+  push_off();
+  id = cpuid();
+  if(c->mag[id].n == 0){
+    // refill half a magazine from the slabs.
+    acquire(&c->lock);
+    while(c->mag[id].n < KMC_MAG/2 && (obj = slab_get(c)) != 0)
+      c->mag[id].obj[c->mag[id].n++] = obj;
+    release(&c->lock);
+  }
+  obj = 0;
+  if(c->mag[id].n > 0)
+    obj = c->mag[id].obj[--c->mag[id].n];
+  pop_off();
+  return obj;
+}
+
+// Return an object to cache c.
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  int id;
+
+  push_off();
+  id = cpuid();
+  if(c->mag[id].n == KMC_MAG){
+    // magazine full; return half of it to the slabs.
+    acquire(&c->lock);
+    while(c->mag[id].n > KMC_MAG/2)
+      slab_put(c, c->mag[id].obj[--c->mag[id].n]);
+    release(&c->lock);
+  }
+  c->mag[id].obj[c->mag[id].n++] = obj;
+  pop_off();
+}
+
+// Print the size and page usage of each cache.  For debugging.
+void
+slabstats(void)
+{
+  for(int i = 0; i < kmc.n; i++){
+    struct kmem_cache *c = &kmc.cache[i];
+    int ncached = 0;
+    for(int j = 0; j < NCPU; j++)
+      ncached += c->mag[j].n;
+    printf("slab %s: size %d perslab %d slabs %d cached %d\n",
+           c->name, c->size, c->perslab, c->nslabs, ncached);
+  }
+}
@@ -66,6 +66,28 @@ sys_dup(void)
   return fd;
 }
 
+// Fault in the mmap()ed and heap pages that a read() (write
+// set) or write() of n bytes at addr will copy for f, before
+// readi() or writei() lock the file: vmfault() may lock a mapped
+// file too.  A read() copies no more than the rest of the file.
+// Pipes, devices and sockets fault pages in as they copy.
+static void
+ioprefault(struct file *f, uint64 addr, int n, int write)
+{
+  uint size;
+
+  if(f->type != FD_INODE || n <= 0)
+    return;
+  if(write){
+    size = f->ip->size;  // no lock; only a bound.
+    if(f->off >= size)
+      return;
+    if(n > size - f->off)
+      n = size - f->off;
+  }
+  vmprefault(addr, n, write);
+}
+
 uint64
 sys_read(void)
 {
@@ -75,6 +97,7 @@ sys_read(void)
 
   if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
     return -1;
+  ioprefault(f, p, n, 1);
   return fileread(f, p, n);
 }
 
@@ -87,6 +110,7 @@ sys_write(void)
 
   if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
     return -1;
+  ioprefault(f, p, n, 0);
 
   return filewrite(f, p, n);
 }
@@ -125,7 +149,8 @@ sys_link(void)
   if(argstr(0, old, MAXPATH) < 0 || argstr(1, new, MAXPATH) < 0)
     return -1;
 
-  begin_op();
+  // ip's i-node and the new entry.
+  begin_opn(1 + dirlinkcost());
   if((ip = namei(old)) == 0){
     end_op();
     return -1;
@@ -192,7 +217,10 @@ sys_unlink(void)
   if(argstr(0, path, MAXPATH) < 0)
     return -1;
 
-  begin_op();
+  // the directory block and both i-nodes; if this was the last
+  // reference to ip, end_op() frees it in transactions of its
+  // own.
+  begin_opn(3);
   if((dp = nameiparent(path, name)) == 0){
     end_op();
     return -1;
@@ -218,6 +246,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcache_enter(dp, name, 0);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -268,19 +297,40 @@ create(char *path, short type, short major, short minor)
   iupdate(ip);
 
   if(type == T_DIR){  // Create . and .. entries.
-    dp->nlink++;  // for ".."
-    iupdate(dp);
     // No ip->nlink++ for ".": avoid cyclic ref count.
-    if(dirlink(ip, ".", ip->inum) < 0 || dirlink(ip, "..", dp->inum) < 0)
-      panic("create dots");
+    if(dirinit(ip, dp->inum) < 0)
+      goto fail;
   }
 
   if(dirlink(dp, name, ip->inum) < 0)
-    panic("create: dirlink");
+    goto fail;
+
+  if(type == T_DIR){
+    // now that success is guaranteed:
+    dp->nlink++;  // for ".."
+    iupdate(dp);
+  }
 
   iunlockput(dp);
 
   return ip;
+
+ fail:
+  // the directory or the disk is full; free ip.
+  ip->nlink = 0;
+  iupdate(ip);
+  iunlockput(ip);
+  iunlockput(dp);
+  return 0;
+}
+
+// Log blocks that create() may dirty: the new i-node's block,
+// a new directory's first block and its bitmap block, and the
+// new entry.
+static int
+createcost(void)
+{
+  return 3 + dirlinkcost();
 }
 
 uint64
@@ -295,7 +345,10 @@ sys_open(void)
   if((n = argstr(0, path, MAXPATH)) < 0 || argint(1, &omode) < 0)
     return -1;
 
-  begin_op();
+  if(omode & O_CREATE)
+    begin_opn(createcost());
+  else
+    begin_op();
 
   if(omode & O_CREATE){
     ip = create(path, T_FILE, 0, 0);
@@ -341,13 +394,14 @@ sys_open(void)
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
 
-  if((omode & O_TRUNC) && ip->type == T_FILE){
-    itrunc(ip);
-  }
-
   iunlock(ip);
   end_op();
 
+  // truncating a big file takes several transactions; f holds
+  // a reference to ip meanwhile.
+  if((omode & O_TRUNC) && ip->type == T_FILE)
+    itruncate(ip);
+
   return fd;
 }
 
@@ -357,7 +411,7 @@ sys_mkdir(void)
   char path[MAXPATH];
   struct inode *ip;
 
-  begin_op();
+  begin_opn(createcost());
   if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
     end_op();
     return -1;
@@ -374,7 +428,7 @@ sys_mknod(void)
   char path[MAXPATH];
   int major, minor;
 
-  begin_op();
+  begin_opn(createcost());
   if((argstr(0, path, MAXPATH)) < 0 ||
      argint(1, &major) < 0 ||
      argint(2, &minor) < 0 ||
@@ -412,19 +466,26 @@ sys_chdir(void)
   return 0;
 }
 
-uint64
-sys_exec(void)
+static void
+freeargv(char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
   int i;
-  uint64 uargv, uarg;
 
-  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  for(i = 0; i < MAXARG && argv[i] != 0; i++)
+    kfree(argv[i]);
+}
+
+// Copy the user's argument vector at uargv into argv[MAXARG],
+// one kalloc()ed page per string.
+static int
+fetchargv(uint64 uargv, char **argv)
+{
+  int i;
+  uint64 uarg;
+
+  memset(argv, 0, MAXARG*sizeof(char*));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
+    if(i >= MAXARG){
       goto bad;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
@@ -440,18 +501,64 @@ sys_exec(void)
     if(fetchstr(uarg, argv[i], PGSIZE) < 0)
       goto bad;
   }
+  return 0;
+
+ bad:
+  freeargv(argv);
+  return -1;
+}
 
-  int ret = exec(path, argv);
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv;
+  int ret;
 
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
+    return -1;
+  }
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
+
+  ret = exec(path, argv);
 
+  freeargv(argv);
   return ret;
+}
 
- bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
-  return -1;
+// spawn(path, argv, fdmap, nfd) starts path in a new process.
+// fdmap, if not 0, lists the caller's descriptors to give the
+// child as its descriptors 0..nfd-1, with -1 for closed.
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  int fdmap[NOFILE], nfd, i, ret;
+  uint64 uargv, ufdmap;
+  struct proc *p = myproc();
+
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0 ||
+     argaddr(2, &ufdmap) < 0 || argint(3, &nfd) < 0)
+    return -1;
+  if(ufdmap){
+    if(nfd < 0 || nfd > NOFILE ||
+       copyin(p->pagetable, (char*)fdmap, ufdmap, nfd*sizeof(int)) < 0)
+      return -1;
+    for(i = 0; i < nfd; i++){
+      if(fdmap[i] == -1)
+        continue;
+      if(fdmap[i] < 0 || fdmap[i] >= NOFILE || p->ofile[fdmap[i]] == 0)
+        return -1;
+    }
+  }
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
+
+  ret = spawn(path, argv, ufdmap ? fdmap : 0, nfd);
+
+  freeargv(argv);
+  return ret;
 }
 
 uint64
@@ -485,6 +592,39 @@ sys_pipe(void)
   return 0;
 }
 
+// mmap(addr, len, prot, flags, fd, off) maps len bytes of regular
+// file fd from page-aligned offset off.  addr is only a hint, and
+// is ignored.
+uint64
+sys_mmap(void)
+{
+  struct file *f;
+  uint64 len;
+  int prot, flags, off;
+
+  if(argaddr(1, &len) < 0 || argint(2, &prot) < 0 || argint(3, &flags) < 0 ||
+     argfd(4, 0, &f) < 0 || argint(5, &off) < 0)
+    return -1;
+  if(off < 0 || off % PGSIZE != 0)
+    return -1;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  if(f->type != FD_INODE || f->ip->type != T_FILE || !f->readable)
+    return -1;
+  if(flags == MAP_SHARED && (prot & PROT_WRITE) && !f->writable)
+    return -1;
+  return vmmap(len, prot, flags, f->ip, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &len) < 0)
+    return -1;
+  return vmunmap(addr, len);
+}
 
 #ifdef LAB_NET
 int
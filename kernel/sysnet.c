@@ -14,34 +14,101 @@
 #include "file.h"
 #include "net.h"
 
+// received packets a socket holds before it drops new ones.
+// Build with SOCK_RXRING=n to change it.  It must be a power of
+// two, so that the free-running ring indices below wrap cleanly,
+// and at most 256, so that a socket fits in a slab page.
+#ifndef SOCK_RXRING
+#define SOCK_RXRING 64
+#endif
+
+// A socket's received packets wait in rxq, a ring with a single
+// producer and a single consumer.  The producer is
+// sockrecvudp(), which only the e1000's polling thread calls; it
+// adds packets without taking a lock.  Readers take the
+// socket's lock among themselves, and so act as one consumer.
+// rxhead and rxtail count up forever; rxtail - rxhead packets
+// are waiting.
 struct sock {
-  struct sock *next; // the next socket in the list
+  struct sock *next; // the next socket in the hash bucket
   uint32 raddr;      // the remote IPv4 address
   uint16 lport;      // the local UDP port number
   uint16 rport;      // the remote UDP port number
-  struct spinlock lock; // protects the rxq
-  struct mbufq rxq;  // a queue of packets waiting to be received
+  struct spinlock lock; // serializes readers
+  int nwaiting;      // readers asleep on rxq
+  uint rxhead;       // next packet to read; written by readers
+  uint rxtail;       // next slot to fill; written by sockrecvudp()
+  int rxdrop;        // packets dropped because rxq was full
+  struct mbuf *rxq[SOCK_RXRING];
+};
+
+// Sockets are found by hashing.  A connected socket is in
+// conntbl, by (raddr, lport, rport).  A wildcard socket, made
+// with raddr and rport 0, takes packets from any sender to its
+// local port, and is in wildtbl by lport; a packet that matches
+// no connected socket goes to the wildcard socket for its port.
+// A wildcard socket has no destination, so it only receives.
+// Each bucket has its own lock, which also keeps the sockets in
+// it from being freed while a packet is delivered.
+#define NSOCKHASH 61
+
+struct sockbucket {
+  struct spinlock lock;
+  struct sock *head;
 };
 
-static struct spinlock lock;
-static struct sock *sockets;
+static struct sockbucket conntbl[NSOCKHASH];
+static struct sockbucket wildtbl[NSOCKHASH];
+static struct kmem_cache *sockcache;
+static int nrxdrop;  // packets dropped by all sockets
 
 void
 sockinit(void)
 {
-  initlock(&lock, "socktbl");
+  for (int i = 0; i < NSOCKHASH; i++) {
+    initlock(&conntbl[i].lock, "sockconn");
+    initlock(&wildtbl[i].lock, "sockwild");
+  }
+  if (SOCK_RXRING <= 0 || SOCK_RXRING > 256 ||
+      (SOCK_RXRING & (SOCK_RXRING - 1)) != 0)
+    panic("sockinit: SOCK_RXRING");
+  sockcache = kmem_cache_create("sock", sizeof(struct sock));
+}
+
+// The bucket that holds the socket for (raddr, lport, rport).
+static struct sockbucket *
+sockbucket(uint32 raddr, uint16 lport, uint16 rport)
+{
+  if (raddr == 0 && rport == 0)
+    return &wildtbl[lport % NSOCKHASH];
+  return &conntbl[(raddr*31*31 + lport*31 + rport) % NSOCKHASH];
+}
+
+// Find the socket for (raddr, lport, rport) in b.
+// Caller holds b->lock.
+static struct sock *
+sockfind(struct sockbucket *b, uint32 raddr, uint16 lport, uint16 rport)
+{
+  struct sock *si;
+
+  for (si = b->head; si; si = si->next) {
+    if (si->raddr == raddr && si->lport == lport && si->rport == rport)
+      return si;
+  }
+  return 0;
 }
 
 int
 sockalloc(struct file **f, uint32 raddr, uint16 lport, uint16 rport)
 {
-  struct sock *si, *pos;
+  struct sockbucket *b;
+  struct sock *si;
 
   si = 0;
   *f = 0;
   if ((*f = filealloc()) == 0)
     goto bad;
-  if ((si = (struct sock*)kalloc()) == 0)
+  if ((si = (struct sock*)kmem_cache_alloc(sockcache)) == 0)
     goto bad;
 
   // initialize objects
@@ -49,32 +116,30 @@ sockalloc(struct file **f, uint32 raddr, uint16 lport, uint16 rport)
   si->lport = lport;
   si->rport = rport;
   initlock(&si->lock, "sock");
-  mbufq_init(&si->rxq);
+  si->nwaiting = 0;
+  si->rxhead = si->rxtail = 0;
+  si->rxdrop = 0;
+
+  // add to the hash table, unless the tuple is taken
+  b = sockbucket(raddr, lport, rport);
+  acquire(&b->lock);
+  if (sockfind(b, raddr, lport, rport)) {
+    release(&b->lock);
+    goto bad;
+  }
+  si->next = b->head;
+  b->head = si;
+  release(&b->lock);
+
   (*f)->type = FD_SOCK;
   (*f)->readable = 1;
   (*f)->writable = 1;
   (*f)->sock = si;
-
-  // add to list of sockets
-  acquire(&lock);
-  pos = sockets;
-  while (pos) {
-    if (pos->raddr == raddr &&
-        pos->lport == lport &&
-	pos->rport == rport) {
-      release(&lock);
-      goto bad;
-    }
-    pos = pos->next;
-  }
-  si->next = sockets;
-  sockets = si;
-  release(&lock);
   return 0;
 
 bad:
   if (si)
-    kfree((char*)si);
+    kmem_cache_free(sockcache, si);
   if (*f)
     fileclose(*f);
   return -1;
@@ -83,28 +148,28 @@ bad:
 void
 sockclose(struct sock *si)
 {
+  struct sockbucket *b;
   struct sock **pos;
-  struct mbuf *m;
 
-  // remove from list of sockets
-  acquire(&lock);
-  pos = &sockets;
-  while (*pos) {
-    if (*pos == si){
+  // remove from the hash table
+  b = sockbucket(si->raddr, si->lport, si->rport);
+  acquire(&b->lock);
+  for (pos = &b->head; *pos; pos = &(*pos)->next) {
+    if (*pos == si) {
       *pos = si->next;
       break;
     }
-    pos = &(*pos)->next;
   }
-  release(&lock);
+  release(&b->lock);
 
-  // free any pending mbufs
-  while (!mbufq_empty(&si->rxq)) {
-    m = mbufq_pophead(&si->rxq);
-    mbuffree(m);
+  // free any pending mbufs; sockrecvudp() can no longer
+  // find the socket.
+  while (si->rxhead != si->rxtail) {
+    mbuffree(si->rxq[si->rxhead % SOCK_RXRING]);
+    si->rxhead++;
   }
 
-  kfree((char*)si);
+  kmem_cache_free(sockcache, si);
 }
 
 int
@@ -115,14 +180,23 @@ sockread(struct sock *si, uint64 addr, int n)
   int len;
 
   acquire(&si->lock);
-  while (mbufq_empty(&si->rxq) && !pr->killed) {
-    sleep(&si->rxq, &si->lock);
+  while (si->rxhead == si->rxtail && !pr->killed) {
+    // announce the sleep before looking at rxtail again, so that
+    // sockrecvudp() either sees nwaiting or we see its packet.
+    si->nwaiting++;
+    __sync_synchronize();
+    if (si->rxhead == si->rxtail)
+      sleep(&si->rxq, &si->lock);
+    si->nwaiting--;
   }
   if (pr->killed) {
     release(&si->lock);
     return -1;
   }
-  m = mbufq_pophead(&si->rxq);
+  m = si->rxq[si->rxhead % SOCK_RXRING];
+  // the slot is free for sockrecvudp() once rxhead moves on.
+  __sync_synchronize();
+  si->rxhead++;
   release(&si->lock);
 
   len = m->len;
@@ -142,6 +216,9 @@ sockwrite(struct sock *si, uint64 addr, int n)
   struct proc *pr = myproc();
   struct mbuf *m;
 
+  if (si->raddr == 0 && si->rport == 0)
+    return -1;  // a wildcard socket only receives.
+
   m = mbufalloc(MBUF_DEFAULT_HEADROOM);
   if (!m)
     return -1;
@@ -150,10 +227,35 @@ sockwrite(struct sock *si, uint64 addr, int n)
     mbuffree(m);
     return -1;
   }
-  net_tx_udp(m, si->raddr, si->lport, si->rport);
+  // sleeps while the transmit ring is full.
+  if (net_tx_udp(m, si->raddr, si->lport, si->rport) < 0)
+    return -1;
   return n;
 }
 
+// Add m to si's receive ring, or drop it if the ring is full.
+// Caller holds the lock of si's bucket.
+static void
+sockdeliver(struct sock *si, struct mbuf *m)
+{
+  if (si->rxtail - si->rxhead == SOCK_RXRING) {
+    si->rxdrop++;
+    nrxdrop++;
+    mbuffree(m);
+    return;
+  }
+  si->rxq[si->rxtail % SOCK_RXRING] = m;
+  // publish the packet, then check for readers to wake.
+  __sync_synchronize();
+  si->rxtail++;
+  __sync_synchronize();
+  if (si->nwaiting) {
+    acquire(&si->lock);
+    wakeup(&si->rxq);
+    release(&si->lock);
+  }
+}
+
 // called by protocol handler layer to deliver UDP packets
 void
 sockrecvudp(struct mbuf *m, uint32 raddr, uint16 lport, uint16 rport)
@@ -163,23 +265,28 @@ sockrecvudp(struct mbuf *m, uint32 raddr, uint16 lport, uint16 rport)
   // any sleeping reader. Free the mbuf if there are no sockets
   // registered to handle it.
   //
+  struct sockbucket *b;
   struct sock *si;
 
-  acquire(&lock);
-  si = sockets;
-  while (si) {
-    if (si->raddr == raddr && si->lport == lport && si->rport == rport)
-      goto found;
-    si = si->next;
+  b = sockbucket(raddr, lport, rport);
+  acquire(&b->lock);
+  if ((si = sockfind(b, raddr, lport, rport)) == 0) {
+    // try a wildcard socket on the local port.
+    release(&b->lock);
+    b = sockbucket(0, lport, 0);
+    acquire(&b->lock);
+    si = sockfind(b, 0, lport, 0);
   }
-  release(&lock);
-  mbuffree(m);
-  return;
+  if (si)
+    sockdeliver(si, m);
+  else
+    mbuffree(m);
+  release(&b->lock);
+}
 
-found:
-  acquire(&si->lock);
-  mbufq_pushtail(&si->rxq, m);
-  wakeup(&si->rxq);
-  release(&si->lock);
-  release(&lock);
+// Print socket counters.  For debugging.
+void
+sockstats(void)
+{
+  printf("sock: rxdrop %d\n", nrxdrop);
 }
@@ -45,7 +45,10 @@
 
 // this many virtio descriptors.
 // must be a power of two.
-#define NUM 8
+// each request takes three, so NUM/3 requests can be in flight.
+// the legacy layout puts descriptors and the avail ring in the
+// first page, so NUM*16 + 6 + 2*NUM must not exceed PGSIZE.
+#define NUM 64
 
 // a single descriptor, from the spec.
 struct virtq_desc {
@@ -60,8 +60,10 @@ static struct disk {
   // track info about in-flight operations,
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
+  // a request covers n bufs for consecutive blocks.
   struct {
-    struct buf *b;
+    struct buf *b[MAXRUN];
+    int n;
     char status;
   } info[NUM];
 
@@ -184,12 +186,11 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
 static int
-alloc3_desc(int *idx)
+alloc_descs(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -200,27 +201,20 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// fill in the descriptors of one request for n bufs holding
+// consecutive blocks, and put the chain on the avail ring.
+// the device does not see it until the next QUEUE_NOTIFY.
+static void
+queue_req(struct buf **bufs, int n, int write, int *idx)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
+  uint64 sector = bufs[0]->blockno * (BSIZE / 512);
 
   // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  // a descriptor for type/reserved/sector, then the data, then a
+  // 1-byte status result.  the data may be split over several
+  // descriptors; we use one per buf, so the request has n+2.
 
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
-  }
-
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
   struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
@@ -237,24 +231,31 @@ virtio_disk_rw(struct buf *b, int write)
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  for(int i = 0; i < n; i++){
+    int d = idx[i+1];
+    disk.desc[d].addr = (uint64) bufs[i]->data;
+    disk.desc[d].len = BSIZE;
+    if(write)
+      disk.desc[d].flags = 0; // device reads b->data
+    else
+      disk.desc[d].flags = VRING_DESC_F_WRITE; // device writes b->data
+    disk.desc[d].flags |= VRING_DESC_F_NEXT;
+    disk.desc[d].next = idx[i+2];
+  }
 
+  int st = idx[n+1];
   disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
-
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  disk.desc[st].addr = (uint64) &disk.info[idx[0]].status;
+  disk.desc[st].len = 1;
+  disk.desc[st].flags = VRING_DESC_F_WRITE; // device writes the status
+  disk.desc[st].next = 0;
+
+  // record the bufs for virtio_disk_intr().
+  for(int i = 0; i < n; i++){
+    bufs[i]->disk = 1;
+    disk.info[idx[0]].b[i] = bufs[i];
+  }
+  disk.info[idx[0]].n = n;
 
   // tell the device the first index in our chain of descriptors.
   disk.avail->ring[disk.avail->idx % NUM] = idx[0];
@@ -263,22 +264,73 @@ virtio_disk_rw(struct buf *b, int write)
 
   // tell the device another avail ring entry is available.
   disk.avail->idx += 1; // not % NUM ...
+}
 
+static void
+notify(void)
+{
   __sync_synchronize();
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+}
 
-  // Wait for virtio_disk_intr() to say request has finished.
+// Start reads (write=0) or writes (write=1) of n bufs, ringing
+// the doorbell once for the whole batch, and return without
+// waiting for them to finish.  Runs of up to MAXRUN bufs with
+// consecutive block numbers go to the device as one request.
+// If the queue fills up, the requests queued so far are started
+// and the caller sleeps for free descriptors.
+//
+// When the device finishes with a buf, virtio_disk_intr() clears
+// b->disk and then calls b->iodone(b) from interrupt context if
+// it is set, or wakes up virtio_disk_wait() otherwise.
+void
+virtio_disk_submit(struct buf **bufs, int n, int write)
+{
+  int idx[MAXRUN+2];
+  int queued = 0;
+  int run;
+
+  acquire(&disk.vdisk_lock);
+  for(int i = 0; i < n; i += run){
+    for(run = 1; run < MAXRUN && i + run < n; run++)
+      if(bufs[i+run]->blockno != bufs[i]->blockno + run ||
+         bufs[i+run]->dev != bufs[i]->dev)
+        break;
+    while(alloc_descs(idx, run+2) != 0){
+      if(queued){
+        notify();
+        queued = 0;
+      }
+      sleep(&disk.free[0], &disk.vdisk_lock);
+    }
+    queue_req(bufs+i, run, write, idx);
+    queued++;
+  }
+  if(queued)
+    notify();
+  release(&disk.vdisk_lock);
+}
+
+// Wait for a request started by virtio_disk_submit() without
+// an iodone callback to finish.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
   while(b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
-
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
-
   release(&disk.vdisk_lock);
 }
 
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_submit(&b, 1, write);
+  virtio_disk_wait(b);
+}
+
 void
 virtio_disk_intr()
 {
@@ -304,9 +356,19 @@ virtio_disk_intr()
     if(disk.info[id].status != 0)
       panic("virtio_disk_intr status");
 
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    int n = disk.info[id].n;
+    disk.info[id].n = 0;
+    free_chain(id);
+
+    for(int i = 0; i < n; i++){
+      struct buf *b = disk.info[id].b[i];
+      disk.info[id].b[i] = 0;
+      b->disk = 0;   // disk is done with buf
+      if(b->iodone)
+        b->iodone(b);  // may recycle b
+      else
+        wakeup(b);
+    }
 
     disk.used_idx += 1;
   }
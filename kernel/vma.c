@@ -0,0 +1,376 @@
+// Memory-mapped files.
+//
+// mmap() records a region of a file in one of the process's
+// VMAs without mapping anything, and exec() records each segment
+// of the program the same way.  The first access to each page
+// faults, and vmfault() maps the page:
+// * a whole page at a page-aligned file offset comes from the
+//   page cache (see pcache.c).  A read-only or MAP_SHARED
+//   mapping maps the cache's own page, so reading the file
+//   costs no copy and stores through a shared mapping are seen
+//   by every mapper.  A writable MAP_PRIVATE mapping shares it
+//   copy-on-write until its first store (see uvmcow());
+// * any other page is read from the file into a new page, and
+//   the bytes past the VMA's filesz (a program's BSS) are zero.
+//   This includes every page of the programs built here, since
+//   they are linked with -N (see exec.c).
+// munmap() and exit write a MAP_SHARED, PROT_WRITE region back
+// to the file, up to the file's current size.
+//
+// Program segments lie below the process's size (p->sz), so
+// fork() copies their pages with the rest of memory.  mmap()ed
+// files are placed top-down below the trapframe, above p->sz,
+// which growproc() keeps below them.
+//
+// vmfault() also allocates the heap: a page below p->sz that is
+// in no VMA gets a zeroed page when it is first touched.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "fcntl.h"
+
+// The VMA of p that contains va, or 0.
+static struct vma*
+findvma(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->ip && va >= v->start && va < v->end)
+      return v;
+  }
+  return 0;
+}
+
+// The lowest address in use by p's mmap()ed files; p->sz may
+// not grow past it.
+uint64
+vmabase(struct proc *p)
+{
+  struct vma *v;
+  uint64 base = TRAPFRAME;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->ip && v->start >= p->sz && v->start < base)
+      base = v->start;
+  }
+  return base;
+}
+
+// Map len bytes of ip, from page-aligned offset off, into the
+// current process.  Returns the address, or -1.
+uint64
+vmmap(uint64 len, int prot, int flags, struct inode *ip, uint off)
+{
+  struct proc *p = myproc();
+  struct vma *v, *w;
+  uint64 start, end;
+
+  if(len == 0 || len > TRAPFRAME)
+    return -1;
+  len = PGROUNDUP(len);
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->ip == 0)
+      break;
+  }
+  if(v == &p->vma[NVMA])
+    return -1;
+
+  // find the highest gap of len bytes below the trapframe.
+  end = TRAPFRAME;
+  for(;;){
+    if(end < len || end - len < PGROUNDUP(p->sz))
+      return -1;
+    start = end - len;
+    for(w = p->vma; w < &p->vma[NVMA]; w++){
+      if(w->ip && w->start < end && w->end > start)
+        break;
+    }
+    if(w == &p->vma[NVMA])
+      break;
+    end = w->start;
+  }
+
+  v->start = start;
+  v->end = end;
+  v->prot = prot;
+  v->flags = flags;
+  v->ip = idup(ip);
+  v->off = off;
+  v->filesz = len;
+  return start;
+}
+
+// Allocate the heap page of p at va, which growproc() left for
+// the first touch.
+static int
+heapfault(struct proc *p, uint64 va)
+{
+  pte_t *pte;
+  char *mem;
+
+  va = PGROUNDDOWN(va);
+  if((pte = walk(p->pagetable, va, 0)) != 0 && (*pte & PTE_V))
+    return -1;  // a protection fault, or the stack guard page.
+  if((mem = kzalloc()) == 0)
+    return -1;
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Map the page of p at va, which is in one of p's mappings or
+// its heap and not yet mapped.  Returns 0, or -1 if va is not
+// mapped or the access is not allowed.  May sleep, so the caller
+// must not hold spinlocks, or the mapped inode's lock.
+int
+vmfault(struct proc *p, uint64 va, int write)
+{
+  struct vma *v;
+  pte_t *pte;
+  char *pa, *mem;
+  uint64 pgoff;
+  uint off, n;
+  int perm;
+
+  if((v = findvma(p, va)) == 0)
+    return va < p->sz ? heapfault(p, va) : -1;
+  if(write ? (v->prot & PROT_WRITE) == 0 : (v->prot & (PROT_READ|PROT_EXEC)) == 0)
+    return -1;
+  va = PGROUNDDOWN(va);
+  if((pte = walk(p->pagetable, va, 0)) != 0 && (*pte & PTE_V))
+    return -1;  // a protection fault.
+
+  perm = PTE_U;
+  if(v->prot & PROT_READ)
+    perm |= PTE_R;
+  if(v->prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+
+  pgoff = va - v->start;
+  off = v->off + pgoff;
+  if(pgoff + PGSIZE <= v->filesz && off % PGSIZE == 0){
+    ilock(v->ip);
+    pa = pcache_get(v->ip, off / PGSIZE);
+    iunlock(v->ip);
+    if(pa == 0)
+      return -1;
+    if((v->flags & MAP_PRIVATE) && (v->prot & PROT_WRITE) && !write){
+      // share the cached page until the first store.
+      perm = (perm & ~PTE_W) | PTE_COW;
+    } else if((v->flags & MAP_PRIVATE) && (v->prot & PROT_WRITE)){
+      if((mem = kalloc()) == 0){
+        kfree(pa);
+        return -1;
+      }
+      memmove(mem, pa, PGSIZE);
+      kfree(pa);
+      pa = mem;
+    }
+  } else {
+    if((pa = kzalloc()) == 0)
+      return -1;
+    if(pgoff < v->filesz){
+      n = v->filesz - pgoff < PGSIZE ? v->filesz - pgoff : PGSIZE;
+      ilock(v->ip);
+      if(readi(v->ip, 0, (uint64)pa, off, n) != n){
+        iunlock(v->ip);
+        kfree(pa);
+        return -1;
+      }
+      iunlock(v->ip);
+    }
+  }
+
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)pa, perm) != 0){
+    kfree(pa);
+    return -1;
+  }
+  return 0;
+}
+
+// Fault in the pages of [start, end) for the current process
+// that are not mapped yet.
+static void
+prefault(struct proc *p, uint64 start, uint64 end, int write)
+{
+  uint64 a;
+  pte_t *pte;
+
+  for(a = PGROUNDDOWN(start); a < end; a += PGSIZE){
+    pte = walk(p->pagetable, a, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0)
+      vmfault(p, a, write);
+  }
+}
+
+// Fault in the mapped pages and heap pages of [va, va+n) for the
+// current process, before a system call locks anything that
+// vmfault() would need.  Callers bound n by what the copy can
+// touch.  Failures are left for the copy to report.
+void
+vmprefault(uint64 va, uint64 n, int write)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+
+  if(n == 0 || va + n < va)
+    return;
+  if(va < p->sz)
+    prefault(p, va, va + n < p->sz ? va + n : p->sz, write);
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->ip == 0 || v->end <= va || v->start >= va + n)
+      continue;
+    prefault(p, va > v->start ? va : v->start, va + n < v->end ? va + n : v->end, write);
+  }
+}
+
+// Write the mapped pages of [start, end) of v back to the file.
+static void
+writeback(struct proc *p, struct vma *v, uint64 start, uint64 end)
+{
+  struct inode *ip = v->ip;
+  uint64 a;
+  uint off, n;
+  pte_t *pte;
+
+  for(a = start; a < end; a += PGSIZE){
+    pte = walk(p->pagetable, a, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0)
+      continue;
+    off = v->off + (a - v->start);
+    begin_opn(log_writecost(PGSIZE));
+    ilock(ip);
+    if(off < ip->size){
+      n = ip->size - off < PGSIZE ? ip->size - off : PGSIZE;
+      writei(ip, 0, PTE2PA(*pte), off, n);
+    }
+    iunlock(ip);
+    end_op();
+  }
+}
+
+// Remove [start, end) from v, which it must begin or end.
+static void
+vmadrop(struct proc *p, struct vma *v, uint64 start, uint64 end)
+{
+  if((v->flags & MAP_SHARED) && (v->prot & PROT_WRITE))
+    writeback(p, v, start, end);
+  uvmunmap(p->pagetable, start, (end - start) / PGSIZE, 1);
+
+  if(start == v->start && end == v->end){
+    begin_op();
+    iput(v->ip);
+    end_op();
+    v->ip = 0;
+  } else if(start == v->start){
+    v->off += end - start;
+    v->filesz = v->filesz > end - start ? v->filesz - (end - start) : 0;
+    v->start = end;
+  } else {
+    v->end = start;
+  }
+}
+
+// Unmap [va, va+len) of the current process, which must be at
+// the start or end of a mapping (or all of it).
+int
+vmunmap(uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 end;
+
+  if(va % PGSIZE != 0 || len == 0 || (v = findvma(p, va)) == 0)
+    return -1;
+  if(v->start < p->sz)
+    return -1;  // part of the program.
+  end = PGROUNDUP(va + len);
+  if(end < va || end > v->end)
+    return -1;
+  if(va != v->start && end != v->end)
+    return -1;  // would split the mapping.
+  vmadrop(p, v, va, end);
+  return 0;
+}
+
+// Give child np copies of p's mappings.  Pages of shared
+// mappings stay shared; writable private pages become
+// copy-on-write.  Pages below p->sz are left to uvmcopy().
+// Returns 0, or -1 with nothing mapped in np.
+int
+vmafork(struct proc *p, struct proc *np)
+{
+  struct vma *v;
+  int i;
+
+  for(i = 0; i < NVMA; i++){
+    v = &p->vma[i];
+    if(v->ip == 0 || v->start < p->sz)
+      continue;
+    if(uvmshare(p->pagetable, np->pagetable, v->start, v->end, v->flags & MAP_PRIVATE) < 0)
+      goto err;
+  }
+
+  for(i = 0; i < NVMA; i++){
+    np->vma[i] = p->vma[i];
+    if(p->vma[i].ip)
+      idup(p->vma[i].ip);
+  }
+  return 0;
+
+ err:
+  for(i = 0; i < NVMA; i++){
+    v = &p->vma[i];
+    if(v->ip && v->start >= p->sz)
+      uvmunmap(np->pagetable, v->start, (v->end - v->start) / PGSIZE, 1);
+  }
+  return -1;
+}
+
+// Unmap all of p's mappings, writing shared ones back.
+// Called by exit() and exec().
+void
+vmafree(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->ip)
+      vmadrop(p, v, v->start, v->end);
+  }
+}
+
+// p's size shrank from oldsz to sz, and the pages above sz are
+// gone.  Trim the program segments that lay below oldsz to match.
+void
+vmatrim(struct proc *p, uint64 oldsz, uint64 sz)
+{
+  struct vma *v;
+
+  sz = PGROUNDUP(sz);
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->ip == 0 || v->start >= oldsz || v->end <= sz)
+      continue;
+    if(v->start >= sz){
+      begin_op();
+      iput(v->ip);
+      end_op();
+      v->ip = 0;
+    } else {
+      v->end = sz;
+    }
+  }
+}
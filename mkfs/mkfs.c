@@ -20,7 +20,8 @@
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
 
-int nbitmap = FSSIZE/(BSIZE*8) + 1;
+int fssize = FSSIZE;
+int nbitmap;
 int ninodeblocks = NINODES / IPB + 1;
 int nlog = LOGSIZE;
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
@@ -28,7 +29,6 @@ int nblocks;  // Number of data blocks
 
 int fsfd;
 struct superblock sb;
-char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
 
@@ -40,6 +40,7 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void mkdirents(uint inum, uint parent, struct dirent *de, int n);
 
 // convert to intel byte order
 ushort
@@ -67,35 +68,59 @@ xint(uint x)
 int
 main(int argc, char *argv[])
 {
-  int i, cc, fd;
-  uint rootino, inum, off;
-  struct dirent de;
+  int i, cc, fd, argi;
+  uint rootino, inum;
+  struct dirent *de;
   char buf[BSIZE];
-  struct dinode din;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
-  if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+  // options come before the image name.
+  for(argi = 1; argi < argc && argv[argi][0] == '-'; argi += 2){
+    if(strcmp(argv[argi], "-l") == 0 && argi + 1 < argc){
+      nlog = atoi(argv[argi+1]);
+    } else if(strcmp(argv[argi], "-s") == 0 && argi + 1 < argc){
+      fssize = atoi(argv[argi+1]);
+    } else {
+      argi = argc;
+      break;
+    }
+  }
+  if(argi >= argc){
+    fprintf(stderr, "Usage: mkfs [-l nlog] [-s size] fs.img files...\n");
+    exit(1);
+  }
+  // the kernel's begin_op() reserves MAXOPBLOCKS log blocks,
+  // after the header block.
+  if(nlog - 1 < MAXOPBLOCKS || nlog - 1 > MAXLOGSIZE){
+    fprintf(stderr, "mkfs: log must have %d..%d blocks\n",
+            MAXOPBLOCKS + 1, (int)MAXLOGSIZE + 1);
+    exit(1);
+  }
+  // the kernel keeps one free count per bitmap block in a page.
+  if(fssize <= 2 + nlog + NINODES / IPB + 1 + 1 || fssize > 4096/sizeof(int)*BSIZE*8){
+    fprintf(stderr, "mkfs: size must be at most %d blocks and leave room for data\n",
+            (int)(4096/sizeof(int)*BSIZE*8));
     exit(1);
   }
 
   assert((BSIZE % sizeof(struct dinode)) == 0);
   assert((BSIZE % sizeof(struct dirent)) == 0);
 
-  fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
+  fsfd = open(argv[argi], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0){
-    perror(argv[1]);
+    perror(argv[argi]);
     exit(1);
   }
 
   // 1 fs block = 1 disk sector
+  nbitmap = fssize/(BSIZE*8) + 1;
   nmeta = 2 + nlog + ninodeblocks + nbitmap;
-  nblocks = FSSIZE - nmeta;
+  nblocks = fssize - nmeta;
 
   sb.magic = FSMAGIC;
-  sb.size = xint(FSSIZE);
+  sb.size = xint(fssize);
   sb.nblocks = xint(nblocks);
   sb.ninodes = xint(NINODES);
   sb.nlog = xint(nlog);
@@ -104,12 +129,15 @@ main(int argc, char *argv[])
   sb.bmapstart = xint(2+nlog+ninodeblocks);
 
   printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+         nmeta, nlog, ninodeblocks, nbitmap, nblocks, fssize);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
-    wsect(i, zeroes);
+  // a sparse file reads back as zeroes.
+  if(ftruncate(fsfd, (off_t)fssize * BSIZE) < 0){
+    perror("ftruncate");
+    exit(1);
+  }
 
   memset(buf, 0, sizeof(buf));
   memmove(buf, &sb, sizeof(sb));
@@ -118,17 +146,10 @@ main(int argc, char *argv[])
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
+  // the root directory's entries, written once all are known.
+  de = calloc(argc, sizeof(*de));
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
-
-  for(i = 2; i < argc; i++){
+  for(i = argi + 1; i < argc; i++){
     // get rid of "user/"
     char *shortname;
     if(strncmp(argv[i], "user/", 5) == 0)
@@ -152,10 +173,8 @@ main(int argc, char *argv[])
 
     inum = ialloc(T_FILE);
 
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    de[i - argi - 1].inum = xshort(inum);
+    strncpy(de[i - argi - 1].name, shortname, DIRSIZ);
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -163,12 +182,7 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  mkdirents(rootino, rootino, de, argc - argi - 1);
 
   balloc(freeblock);
 
@@ -256,10 +270,59 @@ balloc(int used)
   }
   printf("balloc: write bitmap block at sector %d\n", sb.bmapstart);
   wsect(sb.bmapstart, buf);
+  // the other bitmap blocks are all free, as ftruncate left them.
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return the disk block holding file block fbn of din, allocating
+// it if needed, with the same layout policy as bmap() in the kernel:
+// grow the last extent, else start a new one, else use the
+// doubly-indirect block.
+uint
+fbmap(struct dinode *din, uint fbn)
+{
+  uint start, x, ind;
+  uint indirect[NINDIRECT];
+  int i;
+
+  start = 0;
+  for(i = 0; i < NEXTENT && xint(din->ext[i].len); i++){
+    if(fbn < start + xint(din->ext[i].len))
+      return xint(din->ext[i].addr) + fbn - start;
+    start += xint(din->ext[i].len);
+  }
+  if(fbn == start && xint(din->dindirect) == 0){
+    if(i > 0 && xint(din->ext[i-1].addr) + xint(din->ext[i-1].len) == freeblock){
+      din->ext[i-1].len = xint(xint(din->ext[i-1].len) + 1);
+      return freeblock++;
+    }
+    if(i < NEXTENT){
+      din->ext[i].addr = xint(freeblock);
+      din->ext[i].len = xint(1);
+      return freeblock++;
+    }
+  }
+
+  fbn -= start;
+  assert(fbn < NINDIRECT * NINDIRECT);
+  if(xint(din->dindirect) == 0)
+    din->dindirect = xint(freeblock++);
+  rsect(xint(din->dindirect), (char*)indirect);
+  if(indirect[fbn / NINDIRECT] == 0){
+    indirect[fbn / NINDIRECT] = xint(freeblock++);
+    wsect(xint(din->dindirect), (char*)indirect);
+  }
+  ind = xint(indirect[fbn / NINDIRECT]);
+  rsect(ind, (char*)indirect);
+  if(indirect[fbn % NINDIRECT] == 0){
+    indirect[fbn % NINDIRECT] = xint(freeblock++);
+    wsect(ind, (char*)indirect);
+  }
+  x = xint(indirect[fbn % NINDIRECT]);
+  return x;
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -267,7 +330,6 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -276,22 +338,7 @@ iappend(uint inum, void *xp, int n)
   while(n > 0){
     fbn = off / BSIZE;
     assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
+    x = fbmap(&din, fbn);
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
     bcopy(p, buf + off - (fbn * BSIZE), n1);
@@ -303,3 +350,83 @@ iappend(uint inum, void *xp, int n)
   din.size = xint(off);
   winode(inum, &din);
 }
+
+// Same as dirhash() in the kernel.
+uint
+dirhash(char *name)
+{
+  uint h = 2166136261;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+int
+hashcmp(const void *a, const void *b)
+{
+  uint ha = dirhash(((struct dirent*)a)->name);
+  uint hb = dirhash(((struct dirent*)b)->name);
+
+  return ha < hb ? -1 : ha > hb;
+}
+
+// The end of the leaf that starts with de[i]: after DPB*3/4
+// names, but not inside a run of names with one hash.
+int
+leafend(struct dirent *de, int i, int n)
+{
+  int j;
+
+  for(j = i + 1; j < n && (j - i < DPB*3/4 ||
+        dirhash(de[j].name) == dirhash(de[j-1].name)); j++)
+    ;
+  assert(j - i <= DPB);
+  return j;
+}
+
+// Write the contents of directory inum, with entries "." and
+// ".." and the n in de, in the hashed format (see kernel/fs.h):
+// leaves filled three-quarters full in hash order, so that the
+// kernel can add names without splitting at once, and a root
+// index pointing at them.
+void
+mkdirents(uint inum, uint parent, struct dirent *de, int n)
+{
+  char root[BSIZE], leaf[BSIZE];
+  struct dirent *dot = (struct dirent*)root;
+  struct dxchunk *c = (struct dxchunk*)(root + 2*sizeof(struct dirent));
+  struct dxentry *e;
+  int i, j, nleaf;
+
+  qsort(de, n, sizeof(*de), hashcmp);
+
+  bzero(root, sizeof(root));
+  dot[0].inum = xshort(inum);
+  strcpy(dot[0].name, ".");
+  dot[1].inum = xshort(parent);
+  strcpy(dot[1].name, "..");
+  c[0].depth = 1;
+
+  // count the leaves and fill in the index.
+  nleaf = 0;
+  for(i = 0; i < n; i = j){
+    j = leafend(de, i, n);
+    assert(nleaf < DXROOT);
+    e = &c[nleaf / DXPERCHUNK].e[nleaf % DXPERCHUNK];
+    e->hash = xint(nleaf == 0 ? 0 : dirhash(de[i].name));
+    e->block = xint(1 + nleaf);
+    nleaf++;
+  }
+  c[0].count = xshort(nleaf);
+  iappend(inum, root, BSIZE);
+
+  for(i = 0; i < n; i = j){
+    j = leafend(de, i, n);
+    bzero(leaf, sizeof(leaf));
+    memmove(leaf, &de[i], (j - i) * sizeof(*de));
+    iappend(inum, leaf, BSIZE);
+  }
+}
@@ -48,6 +48,86 @@ ping(uint16 sport, uint16 dport, int attempts)
   }
 }
 
+//
+// a wildcard socket, connect(0, lport, 0), receives the packets
+// to lport that no connected socket takes, and can't send.
+//
+static void
+wildcard(uint16 lport, uint16 dport)
+{
+  int wfd, fd, pid, cc;
+  char *obuf = "a message from xv6!";
+  char ibuf[128];
+  uint32 dst;
+
+  // 10.0.2.2, the external host, as in ping().
+  dst = (10 << 24) | (0 << 16) | (2 << 8) | (2 << 0);
+
+  if((wfd = connect(0, lport, 0)) < 0){
+    fprintf(2, "wildcard: connect() failed\n");
+    exit(1);
+  }
+  if(write(wfd, obuf, strlen(obuf)) >= 0){
+    fprintf(2, "wildcard: send() on a wildcard socket succeeded\n");
+    exit(1);
+  }
+
+  // the host's reply goes to the connected socket for it,
+  // even though the wildcard socket was made first.
+  if((fd = connect(dst, lport, dport)) < 0){
+    fprintf(2, "wildcard: connect() failed\n");
+    exit(1);
+  }
+  if(write(fd, obuf, strlen(obuf)) < 0){
+    fprintf(2, "wildcard: send() failed\n");
+    exit(1);
+  }
+  cc = read(fd, ibuf, sizeof(ibuf)-1);
+  if(cc < 0){
+    fprintf(2, "wildcard: recv() failed\n");
+    exit(1);
+  }
+  close(fd);
+  ibuf[cc] = '\0';
+  if(strcmp(ibuf, "this is the host!") != 0){
+    fprintf(2, "wildcard: connected socket didn't receive correct payload\n");
+    exit(1);
+  }
+
+  // with the connected socket gone, replies go to the wildcard
+  // socket.  a reply can beat close() to a connected socket, so a
+  // child keeps sending until the wildcard socket gets one.
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "wildcard: fork() failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    for(;;){
+      if((fd = connect(dst, lport, dport)) < 0){
+        fprintf(2, "wildcard: connect() failed\n");
+        exit(1);
+      }
+      write(fd, obuf, strlen(obuf));
+      close(fd);
+      sleep(10);
+    }
+  }
+  cc = read(wfd, ibuf, sizeof(ibuf)-1);
+  kill(pid);
+  wait(0);
+  if(cc < 0){
+    fprintf(2, "wildcard: recv() failed\n");
+    exit(1);
+  }
+  close(wfd);
+  ibuf[cc] = '\0';
+  if(strcmp(ibuf, "this is the host!") != 0){
+    fprintf(2, "wildcard: wildcard socket didn't receive correct payload\n");
+    exit(1);
+  }
+}
+
 // Encode a DNS name
 static void
 encode_qname(char *qn, char *host)
@@ -252,6 +332,10 @@ main(int argc, char *argv[])
       exit(1);
   }
   printf("OK\n");
+
+  printf("testing wildcard socket: ");
+  wildcard(2100, dport);
+  printf("OK\n");
   
   printf("testing DNS\n");
   dns();
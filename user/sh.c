@@ -3,6 +3,7 @@
 #include "kernel/types.h"
 #include "user/user.h"
 #include "kernel/fcntl.h"
+#include "kernel/param.h"
 
 // Parsed command representation
 #define EXEC  1
@@ -52,6 +53,7 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+void freecmd(struct cmd*);
 
 // Execute cmd.  Never returns.
 void
@@ -130,6 +132,131 @@ runcmd(struct cmd *cmd)
   exit(0);
 }
 
+// The children started for the current command line.
+int pids[NPROC];
+int npids;
+
+int
+addpid(int pid)
+{
+  if(npids == NPROC){
+    fprintf(2, "too many processes\n");
+    return -1;
+  }
+  pids[npids++] = pid;
+  return 0;
+}
+
+// Wait for the children started since pids[from].
+void
+waitpids(int from)
+{
+  int pid, i;
+
+  while(npids > from){
+    if((pid = wait(0)) < 0)
+      break;
+    for(i = from; i < npids; i++){
+      if(pids[i] == pid){
+        pids[i] = pids[--npids];
+        break;
+      }
+    }
+  }
+  npids = from;
+}
+
+// Start cmd with standard input in and standard output out,
+// without waiting for it, and record its children in pids.
+// Commands and pipelines are started with spawn(), which does
+// not copy the shell.  A list on the terminal runs one part at a
+// time; anything else, such as a list feeding a pipe, runs in a
+// forked copy of the shell.  Returns -1 if the shell ran out of
+// pipes or processes, and the rest of the line should be
+// abandoned; a command that fails to run is not an error here.
+int
+startcmd(struct cmd *cmd, int in, int out)
+{
+  int p[2], fdmap[3], fd, from, pid, r;
+  struct execcmd *ecmd;
+  struct listcmd *lcmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  if(cmd == 0)
+    return 0;
+
+  switch(cmd->type){
+  case EXEC:
+    ecmd = (struct execcmd*)cmd;
+    if(ecmd->argv[0] == 0)
+      return 0;
+    fdmap[0] = in;
+    fdmap[1] = out;
+    fdmap[2] = 2;
+    if((pid = spawn(ecmd->argv[0], ecmd->argv, fdmap, 3)) < 0){
+      fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+      return 0;
+    }
+    return addpid(pid);
+
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    if((fd = open(rcmd->file, rcmd->mode)) < 0){
+      fprintf(2, "open %s failed\n", rcmd->file);
+      return 0;
+    }
+    r = startcmd(rcmd->cmd, rcmd->fd == 0 ? fd : in, rcmd->fd == 1 ? fd : out);
+    close(fd);
+    return r;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    if(pipe(p) < 0){
+      fprintf(2, "pipe failed\n");
+      return -1;
+    }
+    r = startcmd(pcmd->left, in, p[1]);
+    close(p[1]);
+    if(r == 0)
+      r = startcmd(pcmd->right, p[0], out);
+    close(p[0]);
+    return r;
+
+  case LIST:
+    // waiting for the left side here would hold up whatever
+    // reads or writes the list's other end.
+    if(in != 0 || out != 1)
+      break;
+    lcmd = (struct listcmd*)cmd;
+    from = npids;
+    r = startcmd(lcmd->left, in, out);
+    waitpids(from);
+    if(r < 0)
+      return -1;
+    return startcmd(lcmd->right, in, out);
+  }
+
+  if((pid = fork()) < 0){
+    fprintf(2, "fork failed\n");
+    return -1;
+  }
+  if(pid == 0){
+    if(in != 0){
+      close(0);
+      dup(in);
+    }
+    if(out != 1){
+      close(1);
+      dup(out);
+    }
+    for(fd = 3; fd < NOFILE; fd++)
+      close(fd);
+    runcmd(cmd);
+  }
+  return addpid(pid);
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -146,6 +273,7 @@ main(void)
 {
   static char buf[100];
   int fd;
+  struct cmd *cmd;
 
   // Ensure that three file descriptors are open.
   while((fd = open("console", O_RDWR)) >= 0){
@@ -164,9 +292,11 @@ main(void)
         fprintf(2, "cannot cd %s\n", buf+3);
       continue;
     }
-    if(fork1() == 0)
-      runcmd(parsecmd(buf));
-    wait(0);
+    if((cmd = parsecmd(buf)) == 0)
+      continue;
+    startcmd(cmd, 0, 1);
+    waitpids(0);
+    freecmd(cmd);
   }
   exit(0);
 }
@@ -262,6 +392,18 @@ backcmd(struct cmd *subcmd)
 char whitespace[] = " \t\r\n\v";
 char symbols[] = "<|>&;()";
 
+// The shell parses commands itself, so a syntax error must not
+// exit: syntax() reports it and the parser stops early.
+int syntaxerr;
+
+void
+syntax(char *msg)
+{
+  if(!syntaxerr)
+    fprintf(2, "%s\n", msg);
+  syntaxerr = 1;
+}
+
 int
 gettoken(char **ps, char *es, char **q, char **eq)
 {
@@ -330,12 +472,17 @@ parsecmd(char *s)
   char *es;
   struct cmd *cmd;
 
+  syntaxerr = 0;
   es = s + strlen(s);
   cmd = parseline(&s, es);
   peek(&s, es, "");
-  if(s != es){
+  if(s != es && !syntaxerr){
     fprintf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    syntax("syntax");
+  }
+  if(syntaxerr){
+    freecmd(cmd);
+    return 0;
   }
   nulterminate(cmd);
   return cmd;
@@ -379,8 +526,10 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 
   while(peek(ps, es, "<>")){
     tok = gettoken(ps, es, 0, 0);
-    if(gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+    if(gettoken(ps, es, &q, &eq) != 'a'){
+      syntax("missing file for redirection");
+      break;
+    }
     switch(tok){
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -405,8 +554,10 @@ parseblock(char **ps, char *es)
     panic("parseblock");
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
-  if(!peek(ps, es, ")"))
-    panic("syntax - missing )");
+  if(!peek(ps, es, ")")){
+    syntax("syntax - missing )");
+    return cmd;
+  }
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -431,13 +582,17 @@ parseexec(char **ps, char *es)
   while(!peek(ps, es, "|)&;")){
     if((tok=gettoken(ps, es, &q, &eq)) == 0)
       break;
-    if(tok != 'a')
-      panic("syntax");
+    if(tok != 'a'){
+      syntax("syntax");
+      break;
+    }
+    if(argc >= MAXARGS-1){
+      syntax("too many args");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if(argc >= MAXARGS)
-      panic("too many args");
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
@@ -491,3 +646,41 @@ nulterminate(struct cmd *cmd)
   }
   return cmd;
 }
+
+// Free a parsed command.  The strings point into the input line.
+void
+freecmd(struct cmd *cmd)
+{
+  struct backcmd *bcmd;
+  struct listcmd *lcmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  if(cmd == 0)
+    return;
+
+  switch(cmd->type){
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    freecmd(rcmd->cmd);
+    break;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    freecmd(pcmd->left);
+    freecmd(pcmd->right);
+    break;
+
+  case LIST:
+    lcmd = (struct listcmd*)cmd;
+    freecmd(lcmd->left);
+    freecmd(lcmd->right);
+    break;
+
+  case BACK:
+    bcmd = (struct backcmd*)cmd;
+    freecmd(bcmd->cmd);
+    break;
+  }
+  free(cmd);
+}
@@ -7,6 +7,7 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/elf.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -569,6 +570,10 @@ writetest(char *s)
   }
 }
 
+// more blocks than direct and single-indirect blocks used
+// to allow, but few enough to fit on the disk.
+#define NBIG 300
+
 void
 writebig(char *s)
 {
@@ -580,7 +585,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < NBIG; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed\n", s, i);
@@ -600,7 +605,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != NBIG){
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
@@ -623,6 +628,347 @@ writebig(char *s)
   }
 }
 
+// write two files a block at a time, in turn, so that neither
+// is contiguous on disk and both run out of extents.
+void
+bigfrag(char *s)
+{
+  enum { N = 40 };
+  char *names[2] = { "frag0", "frag1" };
+  int fds[2], i, j, n;
+
+  for(j = 0; j < 2; j++){
+    fds[j] = open(names[j], O_CREATE|O_RDWR|O_TRUNC);
+    if(fds[j] < 0){
+      printf("%s: create %s failed\n", s, names[j]);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    for(j = 0; j < 2; j++){
+      memset(buf, 'a' + j, BSIZE);
+      ((int*)buf)[0] = i;
+      if(write(fds[j], buf, BSIZE) != BSIZE){
+        printf("%s: write %s block %d failed\n", s, names[j], i);
+        exit(1);
+      }
+    }
+  }
+  for(j = 0; j < 2; j++){
+    close(fds[j]);
+    fds[j] = open(names[j], O_RDONLY);
+    if(fds[j] < 0){
+      printf("%s: open %s failed\n", s, names[j]);
+      exit(1);
+    }
+    for(i = 0; (n = read(fds[j], buf, BSIZE)) == BSIZE; i++){
+      if(((int*)buf)[0] != i || buf[BSIZE-1] != 'a' + j){
+        printf("%s: %s block %d has wrong content\n", s, names[j], i);
+        exit(1);
+      }
+    }
+    if(n != 0 || i != N){
+      printf("%s: %s: read %d blocks\n", s, names[j], i);
+      exit(1);
+    }
+    close(fds[j]);
+    if(unlink(names[j]) < 0){
+      printf("%s: unlink %s failed\n", s, names[j]);
+      exit(1);
+    }
+  }
+}
+
+// the directory name cache must follow creates, links, unlinks
+// and directories being removed and made again.
+void
+namecache(char *s)
+{
+  int fd;
+
+  unlink("nc/f");
+  unlink("nc/g");
+  unlink("nc");
+  if(open("nc/f", O_RDONLY) >= 0 || open("nc/f", O_RDONLY) >= 0){
+    printf("%s: opened nonexistent nc/f\n", s);
+    exit(1);
+  }
+  if(mkdir("nc") < 0){
+    printf("%s: mkdir nc failed\n", s);
+    exit(1);
+  }
+  if(open("nc/f", O_RDONLY) >= 0){
+    printf("%s: opened nonexistent nc/f\n", s);
+    exit(1);
+  }
+  if((fd = open("nc/f", O_CREATE|O_RDWR)) < 0){
+    printf("%s: create nc/f failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if((fd = open("nc/f", O_RDONLY)) < 0){
+    printf("%s: open nc/f failed after create\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(link("nc/f", "nc/g") < 0 || (fd = open("nc/g", O_RDONLY)) < 0){
+    printf("%s: link nc/g failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(unlink("nc/f") < 0 || open("nc/f", O_RDONLY) >= 0){
+    printf("%s: nc/f still there after unlink\n", s);
+    exit(1);
+  }
+  if(unlink("nc/g") < 0 || unlink("nc") < 0){
+    printf("%s: unlink failed\n", s);
+    exit(1);
+  }
+  if(open("nc/g", O_RDONLY) >= 0 || open("nc", O_RDONLY) >= 0){
+    printf("%s: nc still there after unlink\n", s);
+    exit(1);
+  }
+  if(mkdir("nc") < 0 || open("nc/g", O_RDONLY) >= 0){
+    printf("%s: new nc is not empty\n", s);
+    exit(1);
+  }
+  if(unlink("nc") < 0){
+    printf("%s: unlink nc failed\n", s);
+    exit(1);
+  }
+}
+
+// mmap() a file: reads, shared write-back, private copies,
+// fork, and use as a read() or write() buffer.
+void
+mmaptest(char *s)
+{
+  enum { SZ = 2*PGSIZE + PGSIZE/2 };
+  int fd, i, pid, xstatus;
+  char *p, *q;
+
+  unlink("mm");
+  if((fd = open("mm", O_CREATE|O_RDWR)) < 0){
+    printf("%s: create mm failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i++)
+    buf[i] = i % 251;
+  if(write(fd, buf, SZ) != SZ){
+    printf("%s: write mm failed\n", s);
+    exit(1);
+  }
+
+  p = mmap(0, SZ, PROT_READ, MAP_SHARED, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < PGROUNDUP(SZ); i++){
+    if(p[i] != (i < SZ ? i % 251 : 0)){
+      printf("%s: mmap byte %d is %d\n", s, i, p[i]);
+      exit(1);
+    }
+  }
+
+  // a store to a read-only mapping is fatal.
+  pid = fork();
+  if(pid == 0){
+    p[0] = 1;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: store to read-only mapping succeeded\n", s);
+    exit(1);
+  }
+
+  // the child sees the mapping, and can use it as a buffer.
+  pid = fork();
+  if(pid == 0){
+    close(fd);
+    if((fd = open("mm2", O_CREATE|O_RDWR)) < 0 || write(fd, p, SZ) != SZ)
+      exit(1);
+    close(fd);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || munmap(p, SZ) < 0){
+    printf("%s: write from mapping failed\n", s);
+    exit(1);
+  }
+  if((i = open("mm2", O_RDONLY)) < 0 || read(i, buf, BSIZE) != BSIZE || buf[BSIZE-1] != (BSIZE-1) % 251){
+    printf("%s: mm2 is wrong\n", s);
+    exit(1);
+  }
+  close(i);
+  unlink("mm2");
+
+  // stores to a private mapping stay private; read() into one works.
+  p = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  q = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1 || q == (char*)-1 || p == q){
+    printf("%s: mmap rw failed\n", s);
+    exit(1);
+  }
+  p[PGSIZE] = 'p';
+  if(q[PGSIZE] != PGSIZE % 251){
+    printf("%s: private store is visible\n", s);
+    exit(1);
+  }
+  if(read(fd, p, 10) != 0){
+    printf("%s: read at eof\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // stores to a shared mapping reach the file, but not past its end.
+  q[PGSIZE] = 'q';
+  q[SZ] = 'x';
+  pid = fork();
+  if(pid == 0){
+    q[1] = 's';
+    exit(0);
+  }
+  wait(0);
+  if(munmap(q, PGSIZE) < 0 || munmap(q + PGSIZE, SZ - PGSIZE) < 0 ||
+     munmap(p, SZ) < 0 || munmap(p, SZ) == 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  if((fd = open("mm", O_RDONLY)) < 0){
+    printf("%s: open mm failed\n", s);
+    exit(1);
+  }
+  i = read(fd, buf, BSIZE);
+  if(i != BSIZE || buf[1] != 's' || buf[2] != 2){
+    printf("%s: shared store lost\n", s);
+    exit(1);
+  }
+  p = mmap(0, PGSIZE, PROT_READ, MAP_PRIVATE, fd, PGSIZE);
+  if(p == (char*)-1 || p[0] != 'q' || p[1] != (PGSIZE+1) % 251){
+    printf("%s: mmap at offset failed\n", s);
+    exit(1);
+  }
+  if(read(fd, p, 1) >= 0){
+    printf("%s: read into read-only mapping\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, open("mm", O_RDONLY), 0) != (char*)-1){
+    printf("%s: writable mapping of read-only fd\n", s);
+    exit(1);
+  }
+  unlink("mm");
+  // exit unmaps p.
+}
+
+// exec maps the program lazily: BSS pages read as zero, data
+// pages have their initial values, and untouched pages work as
+// system call buffers, even for a pipe, which copies with a
+// spinlock held.
+char lazybss[4*PGSIZE];
+char lazypipe[2*PGSIZE];
+int lazydata = 0x1234;
+
+void
+demandexec(char *s)
+{
+  int fds[2], i, pid, xstatus;
+
+  if(lazydata != 0x1234){
+    printf("%s: lazydata is %x\n", s, lazydata);
+    exit(1);
+  }
+  pid = fork();
+  if(pid == 0){
+    lazybss[PGSIZE] = 1;
+    lazydata = 0;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || lazydata != 0x1234){
+    printf("%s: child's store is visible\n", s);
+    exit(1);
+  }
+  for(i = 0; i < sizeof(lazybss); i += 512){
+    if(lazybss[i] != 0){
+      printf("%s: bss byte %d is %d\n", s, i, lazybss[i]);
+      exit(1);
+    }
+  }
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(write(fds[1], "demand", 6) != 6 ||
+     read(fds[0], &lazypipe[PGSIZE - 3], 6) != 6 ||
+     memcmp(&lazypipe[PGSIZE - 3], "demand", 6) != 0){
+    printf("%s: pipe into bss failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// fork shares memory copy-on-write: a child of a process using
+// more than half of memory can run, and stores by either side,
+// including the kernel's copyout() for read(), stay private.
+void
+cowfork(char *s)
+{
+  enum { BIG = 64*1024*1024 };
+  int fds[2], i, n, pid, xstatus;
+  char *p;
+
+  p = sbrk(BIG);
+  if(p == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < BIG; i += PGSIZE)
+    p[i] = i / PGSIZE;
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  for(n = 0; n < 3; n++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      for(i = 0; i < BIG; i += 64*PGSIZE){
+        if(p[i] != (char)(i / PGSIZE))
+          exit(1);
+        p[i] = 0;
+      }
+      if(read(fds[0], p + PGSIZE, 4) != 4 || memcmp(p + PGSIZE, "cow!", 4) != 0)
+        exit(1);
+      exit(0);
+    }
+    if(write(fds[1], "cow!", 4) != 4){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("%s: child failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < BIG; i += PGSIZE){
+    if(p[i] != (char)(i / PGSIZE)){
+      printf("%s: child's store is visible\n", s);
+      exit(1);
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+  sbrk(-BIG);
+}
+
 // many creates, followed by unlink test
 void
 createtest(char *s)
@@ -724,6 +1070,114 @@ exectest(char *s)
 
 }
 
+// exec() of a program whose last segment leaves no room for
+// the two stack pages below the trapframe must fail, not map
+// the stack over the trapframe.
+void
+exechigh(char *s)
+{
+  int fd, xstatus, pid;
+  struct elfhdr elf;
+  struct proghdr ph;
+  char *args[] = { "exechigh", 0 };
+
+  memset(&elf, 0, sizeof(elf));
+  elf.magic = ELF_MAGIC;
+  elf.entry = TRAPFRAME - 2*PGSIZE;
+  elf.phoff = sizeof(elf);
+  elf.phentsize = sizeof(ph);
+  elf.phnum = 1;
+  memset(&ph, 0, sizeof(ph));
+  ph.type = ELF_PROG_LOAD;
+  ph.flags = ELF_PROG_FLAG_READ | ELF_PROG_FLAG_EXEC;
+  ph.vaddr = TRAPFRAME - 2*PGSIZE;
+  ph.memsz = PGSIZE;
+
+  unlink("exechigh");
+  fd = open("exechigh", O_CREATE|O_WRONLY);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  if(write(fd, &elf, sizeof(elf)) != sizeof(elf) ||
+     write(fd, &ph, sizeof(ph)) != sizeof(ph)){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    exec("exechigh", args);
+    // exec() failed, as it should.
+    exit(0);
+  }
+  wait(&xstatus);
+  unlink("exechigh");
+  if(xstatus != 0){
+    printf("%s: exec succeeded\n", s);
+    exit(1);
+  }
+}
+
+// spawn() with descriptors remapped to a file and a pipe.  The
+// child must not inherit the pipe's write end, or cat would
+// never see end of file.
+void
+spawntest(char *s)
+{
+  int fd, fds[2], xstatus, pid, fdmap[3];
+  char *echoargv[] = { "echo", "OK", 0 };
+  char *catargv[] = { "cat", 0 };
+  char buf[8];
+
+  unlink("spawn-ok");
+  if((fd = open("spawn-ok", O_CREATE|O_RDWR)) < 0 || pipe(fds) < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  fdmap[0] = 0;
+  fdmap[1] = fd;
+  fdmap[2] = 2;
+  pid = spawn("echo", echoargv, fdmap, 3);
+  if(pid < 0 || wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: spawn echo failed\n", s);
+    exit(1);
+  }
+  fdmap[0] = fds[0];
+  pid = spawn("cat", catargv, fdmap, 3);
+  if(pid < 0){
+    printf("%s: spawn cat failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  write(fds[1], "hi", 2);
+  close(fds[1]);
+  if(wait(&xstatus) != pid || xstatus != 0){
+    printf("%s: cat failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if((fd = open("spawn-ok", O_RDONLY)) < 0 || read(fd, buf, sizeof(buf)) != 5 ||
+     memcmp(buf, "OK\nhi", 5) != 0){
+    printf("%s: wrong output\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("spawn-ok");
+
+  fdmap[0] = NOFILE - 1;
+  if(spawn("echo", echoargv, fdmap, 3) >= 0 ||
+     spawn("nonexistent", echoargv, 0, 0) >= 0){
+    printf("%s: bad spawn succeeded\n", s);
+    exit(1);
+  }
+}
+
 // simple fork and pipe read/write
 
 void
@@ -1523,6 +1977,57 @@ bigdir(char *s)
   }
 }
 
+// enough long names in one directory to need a two-level index.
+void
+hashdir(char *s)
+{
+  enum { N = 1400 };
+  char name[48];
+  int i, fd;
+
+  if(mkdir("hd") != 0 || (fd = open("hd/f", O_CREATE|O_RDWR)) < 0){
+    printf("%s: mkdir hd failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  memset(name, 'n', sizeof(name) - 1);
+  name[sizeof(name) - 1] = 0;
+  memmove(name, "hd/", 3);
+  for(i = 0; i < N; i++){
+    name[3] = '0' + i / 1000;
+    name[4] = '0' + i / 100 % 10;
+    name[5] = '0' + i / 10 % 10;
+    name[6] = '0' + i % 10;
+    if(link("hd/f", name) != 0){
+      printf("%s: link %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  for(i = N - 1; i >= 0; i--){
+    name[3] = '0' + i / 1000;
+    name[4] = '0' + i / 100 % 10;
+    name[5] = '0' + i / 10 % 10;
+    name[6] = '0' + i % 10;
+    if((fd = open(name, O_RDONLY)) < 0){
+      printf("%s: open %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+    if(unlink(name) != 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(unlink("hd") == 0){
+    printf("%s: unlinked non-empty hd\n", s);
+    exit(1);
+  }
+  if(unlink("hd/f") != 0 || unlink("hd") != 0){
+    printf("%s: unlink hd failed\n", s);
+    exit(1);
+  }
+}
+
 void
 subdir(char *s)
 {
@@ -1838,47 +2343,48 @@ bigfile(char *s)
 void
 fourteen(char *s)
 {
+  char a[DIRSIZ+1], b[DIRSIZ+2], path[2*(DIRSIZ+1)+2];
   int fd;
 
-  // DIRSIZ is 14.
+  // names are cut to DIRSIZ characters, so b names the same
+  // entry as a.
+  memset(a, 'x', DIRSIZ);
+  a[DIRSIZ] = 0;
+  memset(b, 'x', DIRSIZ+1);
+  b[DIRSIZ+1] = 0;
 
-  if(mkdir("12345678901234") != 0){
-    printf("%s: mkdir 12345678901234 failed\n", s);
+  if(mkdir(a) != 0){
+    printf("%s: mkdir %s failed\n", s, a);
     exit(1);
   }
-  if(mkdir("12345678901234/123456789012345") != 0){
-    printf("%s: mkdir 12345678901234/123456789012345 failed\n", s);
+  if(mkdir(b) == 0){
+    printf("%s: mkdir %s succeeded!\n", s, b);
     exit(1);
   }
-  fd = open("123456789012345/123456789012345/123456789012345", O_CREATE);
+  strcpy(path, b);
+  strcpy(path + strlen(path), "/");
+  strcpy(path + strlen(path), b);
+  fd = open(path, O_CREATE);
   if(fd < 0){
-    printf("%s: create 123456789012345/123456789012345/123456789012345 failed\n", s);
+    printf("%s: create %s failed\n", s, path);
     exit(1);
   }
   close(fd);
-  fd = open("12345678901234/12345678901234/12345678901234", 0);
+  strcpy(path, a);
+  strcpy(path + strlen(path), "/");
+  strcpy(path + strlen(path), a);
+  fd = open(path, 0);
   if(fd < 0){
-    printf("%s: open 12345678901234/12345678901234/12345678901234 failed\n", s);
+    printf("%s: open %s failed\n", s, path);
     exit(1);
   }
   close(fd);
 
-  if(mkdir("12345678901234/12345678901234") == 0){
-    printf("%s: mkdir 12345678901234/12345678901234 succeeded!\n", s);
-    exit(1);
-  }
-  if(mkdir("123456789012345/12345678901234") == 0){
-    printf("%s: mkdir 12345678901234/123456789012345 succeeded!\n", s);
+  // clean up
+  if(unlink(path) != 0 || unlink(b) != 0){
+    printf("%s: unlink failed\n", s);
     exit(1);
   }
-
-  // clean up
-  unlink("123456789012345/12345678901234");
-  unlink("12345678901234/12345678901234");
-  unlink("12345678901234/12345678901234/12345678901234");
-  unlink("123456789012345/123456789012345/123456789012345");
-  unlink("12345678901234/123456789012345");
-  unlink("12345678901234");
 }
 
 void
@@ -1978,9 +2484,10 @@ dirfile(char *s)
 void
 iref(char *s)
 {
+  enum { N = 51 };  // more than the old fixed inode table
   int i, fd;
 
-  for(i = 0; i < NINODE + 1; i++){
+  for(i = 0; i < N; i++){
     if(mkdir("irefd") != 0){
       printf("%s: mkdir irefd failed\n", s);
       exit(1);
@@ -2002,7 +2509,7 @@ iref(char *s)
   }
 
   // clean up
-  for(i = 0; i < NINODE + 1; i++){
+  for(i = 0; i < N; i++){
     chdir("..");
     unlink("irefd");
   }
@@ -2267,7 +2774,65 @@ sbrkfail(char *s)
     exit(1);
 }
 
-  
+// sbrk() allocates pages when they are first touched, so a process
+// can grow far past physical memory and pay only for what it uses.
+void
+sbrklazy(char *s)
+{
+  enum { HUGE=1024*1024*1024 };
+  int fds[2], pid, xstatus;
+  char *a, *oldbrk;
+
+  oldbrk = sbrk(0);
+  a = sbrk(HUGE);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk of untouched memory failed\n", s);
+    exit(1);
+  }
+  a[0] = 1;
+  a[HUGE/2] = 2;
+  a[HUGE-1] = 3;
+  if(a[PGSIZE] != 0 || a[HUGE/4] != 0){
+    printf("%s: untouched page is not zero\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid == 0){
+    if(a[0] != 1 || a[HUGE/2] != 2 || a[HUGE-1] != 3)
+      exit(1);
+    a[HUGE/2] = 4;
+    a[HUGE/3] = 5;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || a[HUGE/2] != 2 || a[HUGE/3] != 0){
+    printf("%s: fork of lazy memory failed\n", s);
+    exit(1);
+  }
+  // a pipe copies out with a lock held.
+  if(pipe(fds) < 0 || write(fds[1], "lazy", 4) != 4 ||
+     read(fds[0], a + HUGE/5, 4) != 4 || memcmp(a + HUGE/5, "lazy", 4) != 0){
+    printf("%s: read into lazy memory failed\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  if(sbrk(-HUGE) == (char*)0xffffffffffffffffL || sbrk(0) != oldbrk){
+    printf("%s: shrink failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid == 0){
+    a[HUGE/2] = 1;  // freed; should be killed.
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: touched memory after shrink\n", s);
+    exit(1);
+  }
+}
+
 // test reads/writes from/to allocated memory
 void
 sbrkarg(char *s)
@@ -2767,6 +3332,8 @@ main(int argc, char *argv[])
     {sharedfd, "sharedfd"},
     {dirtest, "dirtest"},
     {exectest, "exectest"},
+    {exechigh, "exechigh"},
+    {spawntest, "spawntest"},
     {bigargtest, "bigargtest"},
     {bigwrite, "bigwrite"},
     {bsstest, "bsstest"},
@@ -2774,12 +3341,18 @@ main(int argc, char *argv[])
     {sbrkmuch, "sbrkmuch"},
     {kernmem, "kernmem"},
     {sbrkfail, "sbrkfail"},
+    {sbrklazy, "sbrklazy"},
     {sbrkarg, "sbrkarg"},
     {validatetest, "validatetest"},
     {stacktest, "stacktest"},
     {opentest, "opentest"},
     {writetest, "writetest"},
     {writebig, "writebig"},
+    {bigfrag, "bigfrag"},
+    {namecache, "namecache"},
+    {mmaptest, "mmaptest"},
+    {demandexec, "demandexec"},
+    {cowfork, "cowfork"},
     {createtest, "createtest"},
     {openiputtest, "openiput"},
     {exitiputtest, "exitiput"},
@@ -2795,6 +3368,7 @@ main(int argc, char *argv[])
     {iref, "iref"},
     {forktest, "forktest"},
     {bigdir, "bigdir"}, // slow
+    {hashdir, "hashdir"}, // slow
     { 0, 0},
   };
 